@@ -0,0 +1,66 @@
+// Microbenchmark do cálculo do FCS: BCC2 (XOR) vs CRC-16 e CRC-32 (slice-by-8 e PCLMULQDQ)
+//
+// Compilar e executar a partir da raiz do projeto:
+//   $ gcc -O2 -Wall -o bin/fcs_benchmark bench/fcs_benchmark.c src/crc.c -Iinclude/
+//   $ ./bin/fcs_benchmark
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crc.h"
+
+#define BUFFER_SIZE (64 * 1024)
+#define TOTAL_BYTES (256L * 1024 * 1024)  // bytes processados por cada medição
+
+volatile unsigned int sink;  // impede que o compilador elimine os cálculos
+
+// BCC2 tal como calculado originalmente em llwrite/llread
+unsigned char bcc2Xor(const unsigned char *data, int size) {
+    unsigned char bcc2 = data[0];
+    for (int i = 1; i < size; i++) bcc2 ^= data[i];
+    return bcc2;
+}
+
+unsigned int runXor(const unsigned char *data, int size) { return bcc2Xor(data, size); }
+unsigned int runCrc16(const unsigned char *data, int size) { return crc16(data, size); }
+unsigned int runCrc32Slice8(const unsigned char *data, int size) { return crc32Slice8(data, size); }
+unsigned int runCrc32(const unsigned char *data, int size) { return crc32(data, size); }
+
+double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Mede o débito (MB/s) de 'fcs' em blocos de 'size' bytes
+double measure(unsigned int (*fcs)(const unsigned char *, int), const unsigned char *buffer, int size) {
+    long iterations = TOTAL_BYTES / size;
+    int offsets = BUFFER_SIZE / size;
+    double begin = seconds();
+    for (long i = 0; i < iterations; i++) sink ^= fcs(buffer + (i % offsets) * size, size);
+    return TOTAL_BYTES / (seconds() - begin) / 1e6;
+}
+
+int main() {
+    crcInit();
+
+    unsigned char *buffer = (unsigned char *)malloc(BUFFER_SIZE);
+    srand(0);
+    for (int i = 0; i < BUFFER_SIZE; i++) buffer[i] = rand();
+
+    int sizes[] = {64, 256, 1000, 4096};
+    printf("PCLMULQDQ: %s\n\n", crc32HasClmul() ? "sim" : "não");
+    printf("%8s %12s %12s %16s %12s\n", "bytes", "XOR", "CRC-16", "CRC-32 slice8", "CRC-32");
+    for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        printf("%8d %9.0f MB/s %7.0f MB/s %11.0f MB/s %7.0f MB/s\n",
+               sizes[i],
+               measure(runXor, buffer, sizes[i]),
+               measure(runCrc16, buffer, sizes[i]),
+               measure(runCrc32Slice8, buffer, sizes[i]),
+               measure(runCrc32, buffer, sizes[i]));
+    }
+
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,51 @@
+// Link bonding header.
+// Stripes one transfer across several serial ports between the same pair of hosts. The ports are given as a
+// comma-separated list (e.g. "/dev/ttyS0,/dev/ttyS1"), in the same order on both sides; a single port is a plain link.
+// The first link is the control link: control packets go only through it, after every data packet sent before them
+// is acknowledged, so they never overtake data on another link. Data packets go through whichever link is free first,
+// so each link carries a share of the data proportional to its measured throughput.
+
+#ifndef _BOND_H_
+#define _BOND_H_
+
+#include "link_handle.h"
+#include "link_layer.h"
+#include "link_stats.h"
+
+#define MAX_BOND_LINKS 8
+
+typedef struct Bond Bond;
+
+// Receiver: called from one thread per data link (all links but the control link) for each packet received there.
+typedef void (*BondDeliver)(void *context, unsigned char *packet, int packetSize);
+
+// Open a link on each port of the comma-separated list 'ports' with the other parameters of connectionParameters.
+// On the receiver, 'deliver' is called with the packets of the data links; the transmitter passes NULL.
+// Return the bond, or NULL on error.
+Bond *bondOpen(LinkLayer connectionParameters, const char *ports, BondDeliver deliver, void *context);
+
+// Number of links of the bond.
+int bondLinks(Bond *bond);
+
+// Link that carries the control packets (and, on the receiver, the data packets read by the caller).
+LinkHandle *bondControl(Bond *bond);
+
+// Transmitter: hand a data packet to the first free link, which may also be a link that took over the packets of a
+// failed one (the receiver must drop duplicates). Return once the packet is copied, so packet can be reused.
+// Return "1" on success or "-1" if every link failed.
+int bondSend(Bond *bond, const unsigned char *packet, int packetSize);
+
+// Transmitter: wait until every data packet is acknowledged, then send packet through the control link and wait for
+// its acknowledgement, so the receiver gets it after all the data sent before it and before any data sent after it.
+// Return "1" on success or "-1" on error.
+int bondSendControl(Bond *bond, const unsigned char *packet, int packetSize);
+
+// Fill stats with the sum of the counters of the links (maxPayloadSize is the smallest of them).
+void bondStatistics(Bond *bond, LinkStatistics *stats);
+
+// Close every link and free the bond; the data links are closed first.
+// if showStatistics == TRUE, the statistics of each link and its share of the data are printed in the console.
+// Return "1" on success or "-1" if the control link could not be closed.
+int bondClose(Bond *bond, int showStatistics);
+
+#endif // _BOND_H_
@@ -0,0 +1,16 @@
+// Compression header.
+// Fast LZ77 block codec (LZ4-style sequences) used by the application layer to compress the data of each data packet.
+
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+// Compress as much of the 'srcSize' bytes of src as fits in 'dstCapacity' bytes of dst.
+// The number of bytes of src taken is stored in 'consumed'; they are a prefix of src, so the rest can go in the next block.
+// Return the number of bytes written to dst.
+int lzCompress(const unsigned char *src, int srcSize, unsigned char *dst, int dstCapacity, int *consumed);
+
+// Decompress the block of 'srcSize' bytes in src into dst, which has room for 'dstCapacity' bytes.
+// Return the number of bytes written to dst, or "-1" if the block is malformed or does not fit.
+int lzDecompress(const unsigned char *src, int srcSize, unsigned char *dst, int dstCapacity);
+
+#endif // _COMPRESS_H_
@@ -0,0 +1,31 @@
+// CRC header.
+// Frame check sequences used by the link layer: CRC-16-CCITT (X.25/HDLC) and CRC-32 (IEEE 802.3/HDLC).
+
+#ifndef _CRC_H_
+#define _CRC_H_
+
+// Build the slice-by-8 tables.
+// Must be called once before any other function of this module.
+void crcInit();
+
+// CRC-16-CCITT as used by HDLC (poly 0x1021 reflected, init 0xFFFF, final XOR 0xFFFF).
+// Transmitted least significant byte first.
+unsigned short crc16(const unsigned char *data, int size);
+
+// CRC-32 as used by HDLC and Ethernet (poly 0x04C11DB7 reflected, init 0xFFFFFFFF, final XOR 0xFFFFFFFF).
+// Uses the carry-less multiplication (PCLMULQDQ) path on x86 CPUs that support it, slice-by-8 otherwise.
+// Transmitted least significant byte first.
+unsigned int crc32(const unsigned char *data, int size);
+
+// Incremental versions: feed the running register (starting at 0xFFFF / 0xFFFFFFFF) with consecutive
+// pieces of the data; the final CRC is the register XORed with the same value.
+unsigned short crc16Update(unsigned short crc, const unsigned char *data, int size);
+unsigned int crc32Update(unsigned int crc, const unsigned char *data, int size);
+
+// CRC-32 computed only with the slice-by-8 tables (used by the benchmark).
+unsigned int crc32Slice8(const unsigned char *data, int size);
+
+// Return 1 if crc32 uses the carry-less multiplication path, 0 otherwise.
+int crc32HasClmul();
+
+#endif // _CRC_H_
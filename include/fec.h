@@ -0,0 +1,23 @@
+// Forward error correction header.
+// Reed-Solomon codes over GF(2^8) (primitive polynomial 0x11D, first consecutive root 1 = alpha^0) used by the link
+// layer to correct byte errors in the information field of I-frames. Codewords have at most FEC_BLOCK_SIZE bytes.
+
+#ifndef _FEC_H_
+#define _FEC_H_
+
+#define FEC_BLOCK_SIZE 255
+
+// Build the Galois field tables.
+// Must be called once before any other function of this module.
+void fecInit();
+
+// Feed 'size' message bytes into the parity register of a codeword with 'nsym' parity bytes.
+// The register must start zeroed; after the whole message it holds the parity bytes, to be sent after the message.
+void rsEncodeUpdate(unsigned char *parity, int nsym, const unsigned char *data, int size);
+
+// Correct in place the codeword of 'size' bytes (message followed by 'nsym' parity bytes).
+// Up to nsym / 2 byte errors are corrected.
+// Return the number of bytes corrected, or "-1" if the errors cannot be corrected.
+int rsDecode(unsigned char *codeword, int size, int nsym);
+
+#endif // _FEC_H_
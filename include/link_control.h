@@ -0,0 +1,13 @@
+// Link control header.
+// Operations beyond those of link_layer.h that let the application layer drive the link.
+
+#ifndef _LINK_CONTROL_H_
+#define _LINK_CONTROL_H_
+
+// Wait until every I-frame sent with llwrite is acknowledged.
+// Used to turn the link around: after llflush the other side may llwrite and this side llread.
+// While waiting, I-frames retransmitted by the other side are acknowledged again.
+// Return "1" on success or "-1" if the maximum number of retransmissions was exceeded.
+int llflush();
+
+#endif // _LINK_CONTROL_H_
@@ -0,0 +1,65 @@
+// Link handle header.
+// Reentrant link layer API: each link keeps all of its state (serial port, window, timers and statistics) in its own
+// LinkHandle, so one process can drive several serial ports at the same time, e.g. one thread per port.
+// A handle must only be used by one thread at a time, except that when both sides negotiate full duplex, one thread may
+// write (linkWrite, linkFlush) while another reads (linkRead, linkReadPlaced); I-frames then also acknowledge the other
+// direction, and both sides must read everything the other sends before linkClose. llopen, llwrite, llread, llflush,
+// llclose and llstatistics are wrappers around these functions that use a single default link.
+
+#ifndef _LINK_HANDLE_H_
+#define _LINK_HANDLE_H_
+
+#include "link_layer.h"
+#include "link_stats.h"
+
+typedef struct LinkHandle LinkHandle;
+
+// Open a connection using the "port" parameters defined in struct linkLayer.
+// Return the handle of the new link, or NULL on error.
+LinkHandle *linkOpen(LinkLayer connectionParameters);
+
+// Send data in buf with size bufSize. A small packet may be held and sent later in one I-frame with the next ones
+// (see linkSetAggregation); buf can be reused as soon as linkWrite returns.
+// Return number of chars written, or "-1" on error.
+int linkWrite(LinkHandle *link, const unsigned char *buf, int bufSize);
+
+// Receive data in packet. Packets aggregated by the other side into one I-frame are returned one per call.
+// Return number of chars read, or "-1" on error.
+int linkRead(LinkHandle *link, unsigned char *packet);
+
+// Return TRUE if the serial port hung up (e.g. the other end of a pty or the cable went away). Every read then fails
+// at once with "-1" instead of waiting, so a caller that retries linkRead on "-1" must stop.
+int linkHungUp(LinkHandle *link);
+
+// Destination of the data of an I-frame, chosen by the caller of linkReadPlaced once the first headerSize bytes
+// (e.g. the application packet header) have arrived, before the frame check sequence is verified.
+// Return where the bytes after the header go and set *capacity to the room there, or return NULL to keep them in packet.
+typedef unsigned char *(*LinkPlacement)(void *context, const unsigned char *header, int headerSize, int *capacity);
+
+// Receive data like linkRead, but without copying the data after the first headerSize bytes: they are destuffed
+// straight into the destination returned by place (e.g. a memory-mapped output file). That destination may be
+// overwritten even if the frame is then rejected. *placed is set to TRUE if the data went there (placed may be NULL).
+// Return number of chars read (header and data), or "-1" on error.
+int linkReadPlaced(LinkHandle *link, unsigned char *packet, int headerSize, LinkPlacement place, void *context, int *placed);
+
+// Wait until every I-frame sent with linkWrite is acknowledged (see llflush).
+// Return "1" on success or "-1" if the maximum number of retransmissions was exceeded.
+int linkFlush(LinkHandle *link);
+
+// Enable (TRUE) or disable (FALSE) the aggregation of small packets written with linkWrite while frames are outstanding,
+// which is on by default if both sides accepted it in linkOpen. Held packets are sent at the latest by the next linkWrite,
+// linkFlush or linkClose, so a caller that stops writing to wait for something else should call linkFlush first.
+void linkSetAggregation(LinkHandle *link, int enabled);
+
+// Close the connection and free the handle, which must not be used afterwards (even on error).
+// if showStatistics == TRUE, the statistics of the link are printed in the console.
+// Return "1" on success or "-1" on error.
+int linkClose(LinkHandle *link, int showStatistics);
+
+// Close the serial port and free the handle without the DISC exchange, for a link whose other side stopped answering.
+void linkAbort(LinkHandle *link);
+
+// Fill stats with the counters of the link, accumulated since linkOpen.
+void linkStatistics(LinkHandle *link, LinkStatistics *stats);
+
+#endif // _LINK_HANDLE_H_
@@ -0,0 +1,21 @@
+// Link statistics header.
+// Counters kept by the link layer, so that the application layer can adapt to the state of the link.
+
+#ifndef _LINK_STATS_H_
+#define _LINK_STATS_H_
+
+typedef struct
+{
+    int maxPayloadSize;   // Maximum information field size negotiated in llopen.
+    int framesSent;       // I-frames sent, including retransmissions.
+    int retransmissions;  // Frames retransmitted after a timeout, REJ or SREJ.
+    int timeouts;         // Retransmission timers that expired.
+    int rejectsReceived;  // REJ and SREJ received: I-frames the receiver discarded (BCC2/FCS error) or missed.
+    int fcsErrors;        // I-frames discarded by this side because of a BCC2/FCS error.
+} LinkStatistics;
+
+// Fill stats with the counters of the link opened by llopen, accumulated since llopen (all zero when no link is open).
+// linkStatistics (link_handle.h) does the same for any link.
+void llstatistics(LinkStatistics *stats);
+
+#endif // _LINK_STATS_H_
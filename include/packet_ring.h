@@ -0,0 +1,42 @@
+// Packet ring header.
+// Single-producer/single-consumer ring of preallocated packet buffers, used to pipeline the transmitter:
+// one thread reads and builds the packets ahead while the other hands them to the link layer.
+
+#ifndef _PACKET_RING_H_
+#define _PACKET_RING_H_
+
+#include <semaphore.h>
+
+typedef struct
+{
+    unsigned char *buffers;  // slots * slotSize bytes, allocated once by ringInit
+    int *sizes;              // Size of the packet published in each slot.
+    int slots;
+    int slotSize;
+    int head;                // Next slot to fill (only touched by the producer).
+    int tail;                // Next slot to drain (only touched by the consumer).
+    sem_t emptySlots;        // Slots the producer may fill.
+    sem_t fullSlots;         // Slots the consumer may drain.
+} PacketRing;
+
+// Allocate a ring with 'slots' buffers of 'slotSize' bytes.
+// Return "1" on success or "-1" on error.
+int ringInit(PacketRing *ring, int slots, int slotSize);
+
+// Producer: wait until a slot is empty and return its buffer.
+unsigned char *ringAcquire(PacketRing *ring);
+
+// Producer: publish the slot returned by the last ringAcquire, holding a packet of 'size' bytes.
+// Sizes <= 0 are passed through unchanged, so they can be used as end-of-stream or error markers.
+void ringPublish(PacketRing *ring, int size);
+
+// Consumer: wait until a packet is published, return its buffer and store its size in 'size'.
+unsigned char *ringPeek(PacketRing *ring, int *size);
+
+// Consumer: give the slot returned by the last ringPeek back to the producer.
+void ringRelease(PacketRing *ring);
+
+// Free the buffers of the ring.
+void ringDestroy(PacketRing *ring);
+
+#endif // _PACKET_RING_H_
@@ -0,0 +1,20 @@
+// Byte stuffing header.
+// Vectorized kernels used by the link layer to stuff and destuff the FLAG (0x7E) and ESC (0x7D) bytes.
+
+#ifndef _STUFFING_H_
+#define _STUFFING_H_
+
+// Select the widest kernel supported by the CPU (AVX2, SSE2 or scalar).
+// Must be called once before any other function of this module.
+void stuffingInit();
+
+// Return the index of the first FLAG or ESC byte in data, or size if there is none.
+int findSpecial(const unsigned char *data, int size);
+
+// Stuff size bytes from src into dest (which must have room for 2 * size bytes).
+// Runs without special bytes are copied in bulk; flagsStuffed and escsStuffed are incremented
+// by the number of FLAG and ESC bytes escaped.
+// Return the number of bytes written to dest.
+int stuffBytes(const unsigned char *src, int size, unsigned char *dest, int *flagsStuffed, int *escsStuffed);
+
+#endif // _STUFFING_H_
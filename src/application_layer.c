@@ -1,35 +1,226 @@
 // Application layer protocol implementation
 
+#define _GNU_SOURCE         // fallocate
+#define _FILE_OFFSET_BITS 64  // ficheiros com mais de 2 GiB também em sistemas de 32 bits
+
 #include "application_layer.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include "bond.h"
+#include "compress.h"
+#include "crc.h"
+#include "link_handle.h"
 #include "link_layer.h"
+#include "link_stats.h"
+#include "packet_ring.h"
 
 #define DATA_PACKET 1
 #define CONTROL_PACKET_START 2
 #define CONTROL_PACKET_END 3
+#define CONTROL_PACKET_RESUME 4    // resposta do recetor ao pacote 'start' ou 'manifest'
+#define CONTROL_PACKET_MANIFEST 5  // início de um lote de ficheiros
 
 #define CONTROL_PACKET_FILE_SIZE 0
 #define CONTROL_PACKET_FILE_NAME 1
+#define CONTROL_PACKET_TRANSFER_ID 2    // identificação da transferência (4 bytes)
+#define CONTROL_PACKET_FINGERPRINT 3    // impressão digital do ficheiro (4 bytes)
+#define CONTROL_PACKET_RESUME_OFFSET 4  // posição a partir da qual a transferência continua
+#define CONTROL_PACKET_FILE_COUNT 5     // número de ficheiros do lote
+#define CONTROL_PACKET_TOTAL_SIZE 6     // soma dos tamanhos dos ficheiros do lote
+#define CONTROL_PACKET_STREAM 7         // só nos pacotes de fluxos diferentes do 0: fluxo do ficheiro (1 byte)
+
+// Transferências retomáveis: o recetor guarda em <ficheiro>CHECKPOINT_SUFFIX a identificação da transferência, a impressão
+// digital do ficheiro e a posição até à qual os dados estão no disco, e responde ao 'start' com a posição a partir da qual
+// o emissor deve continuar, pelo que depois de uma falha da ligação só é enviado o que falta
+#define CHECKPOINT_SUFFIX ".checkpoint"
+#define CHECKPOINT_SIZE 16                      // identificação (4) + impressão digital (4) + posição (8)
+#define FINGERPRINT_SAMPLE_SIZE (64 * 1024)  // bytes do início e do fim do ficheiro que entram na impressão digital
+
+// Lotes: se o emissor receber uma diretoria, envia os seus ficheiros numa só ligação - um pacote 'manifest' com o número
+// de ficheiros, ao qual o recetor responde uma única vez, seguido de 'start'/dados/'end' de cada ficheiro sem esperar
+// por resposta. O recetor escreve os ficheiros na diretoria dada e guarda em BATCH_CHECKPOINT_NAME quantos já estão
+// completos no disco, pelo que um lote interrompido continua no primeiro ficheiro incompleto
+#define BATCH_CHECKPOINT_NAME ".batch" CHECKPOINT_SUFFIX
+#define MAX_MANIFEST_SIZE (1 + 2 * (2 + MAX_NUMBER_LENGTH) + 2 * (2 + 4))  // C + 2 números + identificação + impressão digital
+
+// Os pacotes de dados têm, a seguir a C + L2 + L1, um TLV com a posição dos dados no ficheiro
+#define DATA_PACKET_OFFSET 0
+#define DATA_PACKET_RAW_SIZE 1  // só nos pacotes comprimidos: número de bytes do ficheiro que os dados representam (2 bytes)
+#define DATA_PACKET_STREAM 2    // só nos pacotes de fluxos diferentes do 0: fluxo a que os dados pertencem (1 byte)
+#define MAX_NUMBER_LENGTH 8  // os tamanhos e posições são representados com até 64 bits
+
+// Tamanho dos dados de cada pacote de dados, ajustado durante a transferência à taxa de erros da ligação
+#define DATA_PACKET_HEADER_SIZE 3                                              // C + L2 + L1
+#define DATA_PACKET_MAX_HEADER_SIZE (DATA_PACKET_HEADER_SIZE + 2 + MAX_NUMBER_LENGTH + 4 + 3)  // C + L2 + L1 + 3 TLV
+#define INITIAL_DATA_SIZE 256
+#define MIN_DATA_SIZE 32
+#define ADAPT_INTERVAL 8    // número de pacotes de dados entre dois ajustes do tamanho
+#define ERROR_RATE_HIGH 10  // percentagem de tramas retransmitidas acima da qual o tamanho é reduzido para metade
+
+// O ficheiro é lido em blocos à medida que é enviado, pelo que a memória usada não depende do seu tamanho
+#define READ_BUFFER_SIZE (64 * 1024)  // bytes lidos do ficheiro de cada vez pela thread produtora
+
+// Compressão: a thread produtora comprime os dados de cada pacote de dados com lzCompress, enchendo o pacote com tantos
+// bytes do ficheiro quantos couberem. Se os dados não diminuírem (por exemplo, num ficheiro já comprimido como o
+// penguin.gif), o pacote segue sem compressão, pelo que o pior caso é igual ao envio sem compressão
+#define COMPRESSION 1                   // 0 -> os dados são sempre enviados sem compressão
+#define MAX_RAW_CHUNK_SIZE (16 * 1024)  // bytes do ficheiro representados, no máximo, por um pacote comprimido
+
+// Uma thread produtora lê o ficheiro e constrói os pacotes de dados com até RING_SLOTS pacotes de avanço
+// em relação à thread que os envia
+#define RING_SLOTS 16
+
+// Fluxos: num lote, até MAX_STREAMS ficheiros são enviados ao mesmo tempo, cada um num fluxo identificado nos seus pacotes.
+// A thread produtora escolhe o fluxo de cada pacote de dados por deficit round-robin: em cada volta, um fluxo envia até
+// prioridade x tamanho dos dados bytes, pelo que um ficheiro pequeno ou urgente não espera pelo fim de um ficheiro grande.
+// O emissor aceita, em vez de um ficheiro ou de uma diretoria, uma lista de ficheiros separados por vírgulas, cada um
+// com uma prioridade opcional (por exemplo, "imagem.iso,config.txt:8"), enviada como um lote
+#define MAX_STREAMS 4
+#define MAX_PRIORITY 16
+#define PRIORITY_SEPARATOR ':'
+
+// Ficheiro a enviar
+typedef struct {
+    char *path;        // caminho usado para abrir o ficheiro
+    const char *name;  // nome enviado nos pacotes de controlo
+    long long size;
+    long long modified;  // instante da última modificação
+    unsigned int transferId;
+    unsigned int fingerprint;
+    int priority;  // 1 a MAX_PRIORITY
+} SourceFile;
+
+// Fluxo da thread produtora
+typedef struct {
+    SourceFile *source;      // ficheiro enviado no fluxo, ou NULL se o fluxo estiver livre
+    FILE *file;
+    unsigned char *staging;  // bytes lidos do ficheiro e ainda não enviados
+    int stagedStart;
+    int stagedEnd;
+    long long readOffset;    // posição do ficheiro até à qual os dados já foram lidos
+    long long offset;        // posição dos dados do próximo pacote
+    int deficit;             // bytes de dados que o fluxo ainda pode enviar nesta volta
+} Stream;
+
+// Argumentos da thread produtora
+typedef struct {
+    SourceFile *files;
+    int fileCount;
+    long long offset;    // posição do primeiro pacote de dados do primeiro ficheiro
+    int sendFirstStart;  // FALSE se o pacote 'start' do primeiro ficheiro já foi enviado
+    PacketRing *ring;
+    atomic_int *dataSize;  // tamanho dos dados dos próximos pacotes, ajustado pela thread que os envia
+    long long fileBytes;   // bytes dos ficheiros enviados
+    long long dataBytes;   // bytes dos campos de dados dos pacotes de dados (depois da compressão)
+} Producer;
+
+// No recetor, a thread que chama linkRead passa os pacotes recebidos a uma thread escritora, que junta os dados
+// em blocos de WRITE_BATCH_SIZE bytes escritos com pwrite, pelo que as confirmações não esperam pelo disco
+#define RX_RING_SLOTS 64
+#define WRITE_BATCH_SIZE (64 * 1024)
+
+// Receção sem cópias: com um só ficheiro e uma só porta série, o recetor mapeia o ficheiro em memória no 'start' e a camada
+// de ligação coloca os dados de cada pacote de dados não comprimido diretamente na sua posição do ficheiro (linkReadPlaced).
+// Só o cabeçalho do pacote passa à thread escritora, que apenas o regista; os pacotes comprimidos são descomprimidos
+// diretamente no ficheiro mapeado. O destino é escolhido antes de verificar o FCS, pelo que só é usada a posição que se
+// segue aos dados já recebidos: uma trama rejeitada só estraga dados que vão ser reescritos.
+// O ficheiro só pode ser mapeado com o seu tamanho final, pelo que o recetor o estende no 'start'. Se a transferência
+// terminar antes do fim (erro, SIGINT ou SIGTERM), o ficheiro volta ao tamanho dos dados no disco, indicado pelo checkpoint,
+// e não fica com zeros no fim; só se o processo for morto sem poder reagir (SIGKILL, falha do sistema) o ficheiro fica
+// com o tamanho final e zeros depois do checkpoint, que a transferência retomada reescreve
+#define PLACED_DATA_PACKET 0x81  // só no anel do recetor: pacote de dados cujos dados já estão no ficheiro mapeado
+
+// Destino dos dados recebidos pela thread que chama linkReadPlaced
+typedef struct {
+    unsigned char *map;       // ficheiro mapeado, ou NULL
+    long long mapSize;
+    long long nextOffset;     // posição dos dados do próximo pacote de dados
+    int compressed;           // o último pacote de dados vinha comprimido, pelo que o próximo também deve vir
+    unsigned char header[DATA_PACKET_MAX_HEADER_SIZE];  // cabeçalho visto ao escolher o último destino
+    int headerSize;
+    unsigned char *destination;  // último destino escolhido
+} Placement;
 
-#define MAX_DATA_SIZE 256
+// Ficheiro recebido num fluxo pela thread escritora
+typedef struct {
+    int fd;
+    unsigned char *map;    // ficheiro mapeado (só com um ficheiro e uma só porta série), ou NULL
+    long long mapSize;
+    unsigned char *batch;  // dados contíguos ainda não escritos (com o ficheiro mapeado, não é usado)
+    int batchSize;
+    long long offset;      // posição do bloco no ficheiro
+    long long committed;   // posição até à qual os dados estão no disco
+    int fileIndex;         // posição do ficheiro no lote
+} StreamWriter;
+
+// Argumentos da thread escritora
+// A identificação da transferência e a posição inicial são preenchidas pela thread que recebe o pacote 'start' (ou 'manifest'),
+// antes de passar o pacote seguinte
+typedef struct {
+    int fd;                 // ficheiro a escrever (num lote, cada fluxo abre o seu ficheiro em cada 'start')
+    PacketRing *ring;
+    const char *directory;  // diretoria dos ficheiros de um lote, ou NULL se for enviado um só ficheiro
+    const char *checkpointName;
+    unsigned int transferId;
+    unsigned int fingerprint;
+    long long resumeOffset;  // posição até à qual os dados já estavam no disco
+    int fileCount;           // número de ficheiros do lote
+    int filesCompleted;      // ficheiros do início do lote já completos no disco (os seguintes podem já estar completos)
+    unsigned char *map;      // ficheiro mapeado pela thread que recebe o 'start', ou NULL
+    long long mapSize;
+} Writer;
+
+// Várias portas série (bond.h): os pacotes de dados chegam por várias ligações, fora de ordem. O recetor guarda os que
+// chegam antes dos anteriores e passa-os à thread escritora pela ordem da sua posição no ficheiro, em cada fluxo; os dados
+// de cada ficheiro só passam depois do seu 'start' e o 'end' só passa depois de todos os dados. As threads das ligações
+// nunca esperam pela reordenação, para não deixarem de ler e de confirmar: é o emissor que limita os pacotes fora de ordem (bond.c)
+
+// Pacote de dados recebido fora de ordem
+typedef struct ReorderedPacket {
+    struct ReorderedPacket *next;  // pacote seguinte, com uma posição maior ou de um fluxo seguinte
+    int stream;
+    long long offset;
+    int chunkSize;                 // bytes do ficheiro
+    int packetSize;
+    unsigned char packet[];
+} ReorderedPacket;
+
+// Reordenação dos pacotes recebidos pelas várias ligações, antes do anel da thread escritora
+typedef struct {
+    pthread_mutex_t lock;  // também torna o anel, de um só produtor, seguro com várias threads a publicar
+    pthread_cond_t changed;
+    PacketRing *ring;
+    int started[MAX_STREAMS];           // o 'start' do ficheiro atual do fluxo já passou (e o 'end' ainda não)
+    long long nextOffset[MAX_STREAMS];  // posição dos próximos dados a passar, em cada fluxo
+    ReorderedPacket *packets;  // pacotes guardados, por ordem do fluxo e da posição
+} Reassembler;
 
 // Imprime "Application Layer" seguido do título e do conteúdo
 void printAL(char *title, unsigned char *content, int contentSize) {
     // DEBUG
+    flockfile(stdout);  // o recetor imprime a partir de duas threads
     printf("\nApplication Layer\n");
     for (int i = 0; title[i] != '\0'; i++) printf("%c", title[i]);
     printf("\n");
     for (int i = 0; i < contentSize; i++) printf("0x%x ", content[i]);
     printf("\n");
+    funlockfile(stdout);
 }
 
 // Calcula o logaritmo de base 2 de n
-char logaritmo2(int n) {
+char logaritmo2(unsigned long long n) {
     char res = -1;
     while (n > 0) {
         n /= 2;
@@ -38,91 +229,1037 @@ char logaritmo2(int n) {
     return res;
 }
 
-// Constrói e retorna um pacote de controlo de tipo (START/END) dado por 'controlField', com o tamanho do ficheiro e o nome do ficheiro
-unsigned char *buildControlPacket(unsigned char controlField, long int fileSize, const char *fileName, int *packetSize) {
-    unsigned char fileSizeLength = 1 + (logaritmo2(fileSize) / 8);  // número de bits necessários para representar o tamanho do ficheiro
-    unsigned char fileNameLength = strlen(fileName);                // comprimento do nome do ficheiro
+// Retorna o número de bytes necessários para representar n (pelo menos 1)
+unsigned char numberLength(unsigned long long n) {
+    return 1 + (logaritmo2(n) / 8);
+}
+
+// Escreve n em 'length' bytes de dest, o mais significativo primeiro
+void encodeNumber(unsigned long long n, unsigned char length, unsigned char *dest) {
+    for (int i = length - 1; i >= 0; i--) {
+        dest[i] = n & 0xFF;
+        n >>= 8;
+    }
+}
 
-    *packetSize = 5 + fileSizeLength + fileNameLength;  // 5 -> C + T1 + L1 + T2 + L2
+// Lê um número de 'length' bytes de src, o mais significativo primeiro
+unsigned long long decodeNumber(const unsigned char *src, unsigned char length) {
+    unsigned long long n = 0;
+    for (int i = 0; i < length; i++) n = (n << 8) | src[i];
+    return n;
+}
+
+// Constrói e retorna um pacote de controlo de tipo (START/END) dado por 'controlField', com o tamanho do ficheiro, o nome do ficheiro,
+// a identificação da transferência, a impressão digital do ficheiro e, se não for o 0, o fluxo do ficheiro
+unsigned char *buildControlPacket(unsigned char controlField, long long fileSize, const char *fileName, unsigned int transferId, unsigned int fingerprint, int stream, int *packetSize) {
+    unsigned char fileSizeLength = numberLength(fileSize);  // número de bytes necessários para representar o tamanho do ficheiro
+    unsigned char fileNameLength = strlen(fileName);        // comprimento do nome do ficheiro
+
+    *packetSize = 5 + fileSizeLength + fileNameLength + 12 + (stream > 0 ? 3 : 0);  // 5 -> C + T1 + L1 + T2 + L2; 12 -> T3 + L3 + V3 + T4 + L4 + V4
     unsigned char *controlPacket = (unsigned char *)malloc(*packetSize);
 
     controlPacket[0] = controlField;              // C
     controlPacket[1] = CONTROL_PACKET_FILE_SIZE;  // T1
     controlPacket[2] = fileSizeLength;            // L1
 
-    int index;
-    for (index = 3; index < (fileSizeLength + 3); index++) {
-        // V1 - tamanho do ficheiro
-        unsigned leftmost = fileSize & 0xFF << (fileSizeLength - 1) * 8;
-        leftmost >>= (fileSizeLength - 1) * 8;
-        fileSize <<= 8;
-        controlPacket[index] = leftmost;
-    }
+    encodeNumber(fileSize, fileSizeLength, controlPacket + 3);  // V1 - tamanho do ficheiro
+    int index = 3 + fileSizeLength;
 
     controlPacket[index++] = CONTROL_PACKET_FILE_NAME;        // T2
     controlPacket[index++] = fileNameLength;                  // L2
     memcpy(controlPacket + index, fileName, fileNameLength);  // V2 - nome do ficheiro
+    index += fileNameLength;
+
+    controlPacket[index++] = CONTROL_PACKET_TRANSFER_ID;  // T3
+    controlPacket[index++] = 4;                           // L3
+    encodeNumber(transferId, 4, controlPacket + index);   // V3 - identificação da transferência
+    index += 4;
+
+    controlPacket[index++] = CONTROL_PACKET_FINGERPRINT;  // T4
+    controlPacket[index++] = 4;                           // L4
+    encodeNumber(fingerprint, 4, controlPacket + index);  // V4 - impressão digital do ficheiro
+    index += 4;
+
+    if (stream > 0) {
+        controlPacket[index++] = CONTROL_PACKET_STREAM;  // T5
+        controlPacket[index++] = 1;                      // L5
+        controlPacket[index] = stream;                   // V5 - fluxo do ficheiro
+    }
 
     printAL("Pacote de Controlo Construído", controlPacket, *packetSize);  // DEBUG
 
     return controlPacket;
 }
 
-// Constrói e retorna um pacote de dados
-unsigned char *buildDataPacket(int dataSize, unsigned char *data, int *packetSize) {
-    *packetSize = dataSize + 3;  // 3 -> C + L2 + L1
-    unsigned char *dataPacket = (unsigned char *)malloc(*packetSize);
+// Retorna o tamanho do cabeçalho de um pacote de dados do fluxo 'stream' com os dados na posição offset do ficheiro,
+// comprimidos ou não
+int dataPacketHeaderSize(long long offset, int compressed, int stream) {
+    return DATA_PACKET_HEADER_SIZE + 2 + numberLength(offset) + (compressed ? 4 : 0) + (stream > 0 ? 3 : 0);  // C + L2 + L1 + T + L + V [+ T + L + V]...
+}
 
+// Constrói um pacote de dados cujos 'dataSize' dados, da posição offset do ficheiro, já estão em
+// dataPacket + dataPacketHeaderSize(offset, rawSize > 0, stream), preenchendo o cabeçalho
+// rawSize é o número de bytes do ficheiro que os dados comprimidos representam, ou 0 se os dados não estiverem comprimidos
+// Retorna o tamanho do pacote
+int buildDataPacket(int dataSize, long long offset, int rawSize, int stream, unsigned char *dataPacket) {
+    unsigned char offsetLength = numberLength(offset);
     dataPacket[0] = DATA_PACKET;     // C
     dataPacket[1] = dataSize / 256;  // L1
     dataPacket[2] = dataSize % 256;  // L2
     // dataSize = 256 * L2 + L1
+    dataPacket[3] = DATA_PACKET_OFFSET;                 // T
+    dataPacket[4] = offsetLength;                       // L
+    encodeNumber(offset, offsetLength, dataPacket + 5);  // V - posição dos dados no ficheiro
+    int index = 5 + offsetLength;
+    if (rawSize > 0) {
+        dataPacket[index++] = DATA_PACKET_RAW_SIZE;      // T
+        dataPacket[index++] = 2;                         // L
+        encodeNumber(rawSize, 2, dataPacket + index);    // V - tamanho dos dados descomprimidos
+        index += 2;
+    }
+    if (stream > 0) {
+        dataPacket[index++] = DATA_PACKET_STREAM;  // T
+        dataPacket[index++] = 1;                   // L
+        dataPacket[index] = stream;                // V - fluxo
+    }
 
-    memcpy(dataPacket + 3, data, dataSize);  // dados
+    return dataSize + dataPacketHeaderSize(offset, rawSize > 0, stream);
+}
 
-    printAL("Pacote de Dados Construído", dataPacket, *packetSize);  // DEBUG
+/**
+ * Interpreta o cabeçalho de um pacote de dados
+ * @param packet pacote recebido
+ * @param packetSize tamanho do pacote
+ * @param offset posição dos dados no ficheiro; se o pacote não tiver o TLV da posição, mantém o valor recebido
+ * @param dataSize número de bytes de dados
+ * @param rawSize número de bytes dos dados descomprimidos, ou 0 se os dados não estiverem comprimidos
+ * @param stream fluxo dos dados (0 se o pacote não tiver o TLV do fluxo)
+ * @return tamanho do cabeçalho, ou -1 se o pacote for inválido
+ */
+int parseDataPacket(const unsigned char *packet, int packetSize, long long *offset, int *dataSize, int *rawSize, int *stream) {
+    if (packetSize < DATA_PACKET_HEADER_SIZE) return -1;
+    *dataSize = packet[1] * 256 + packet[2];
+    *rawSize = 0;
+    *stream = 0;
+    int headerSize = DATA_PACKET_HEADER_SIZE;
+    while (packetSize > headerSize + *dataSize) {
+        // TLV da posição dos dados ou do tamanho dos dados descomprimidos
+        if (packetSize < headerSize + 2) return -1;
+        unsigned char type = packet[headerSize];
+        unsigned char length = packet[headerSize + 1];
+        if (type == DATA_PACKET_OFFSET && length <= MAX_NUMBER_LENGTH) {
+            *offset = decodeNumber(packet + headerSize + 2, length);
+        } else if (type == DATA_PACKET_RAW_SIZE && length == 2) {
+            *rawSize = decodeNumber(packet + headerSize + 2, length);
+        } else if (type == DATA_PACKET_STREAM && length == 1 && packet[headerSize + 2] < MAX_STREAMS) {
+            *stream = packet[headerSize + 2];
+        } else {
+            return -1;
+        }
+        headerSize += 2 + length;
+    }
+    if (packetSize != headerSize + *dataSize) return -1;
+    return headerSize;
+}
+
+/**
+ * Calcula a impressão digital de um ficheiro, usada pelo recetor para verificar que um checkpoint corresponde ao mesmo ficheiro
+ * @param fd descritor do ficheiro
+ * @param fileSize tamanho do ficheiro
+ * @param modified instante da última modificação do ficheiro
+ * @return CRC-32 do tamanho, do instante da última modificação e dos primeiros e últimos FINGERPRINT_SAMPLE_SIZE bytes
+ *
+ * @details
+ * Só são lidas as extremidades do ficheiro, pelo que o envio começa de imediato mesmo com ficheiros muito grandes
+ */
+unsigned int fileFingerprint(int fd, long long fileSize, long long modified) {
+    unsigned char header[16];
+    encodeNumber(fileSize, 8, header);
+    encodeNumber(modified, 8, header + 8);
+    unsigned int crc = crc32Update(0xFFFFFFFF, header, sizeof(header));
 
-    return dataPacket;
+    unsigned char *sample = (unsigned char *)malloc(FINGERPRINT_SAMPLE_SIZE);
+    long long offsets[2] = {0, fileSize > FINGERPRINT_SAMPLE_SIZE ? fileSize - FINGERPRINT_SAMPLE_SIZE : 0};
+    for (int i = 0; i < 2; i++) {
+        ssize_t n = pread(fd, sample, FINGERPRINT_SAMPLE_SIZE, offsets[i]);
+        if (n > 0) crc = crc32Update(crc, sample, n);
+    }
+    free(sample);
+    return crc ^ 0xFFFFFFFF;
 }
 
-// Envia um pacote de dados com 'size' dados do conteúdo do ficheiro
-void sendDataPacket(int size, unsigned char *fileContent) {
-    unsigned char *data;
-    data = (unsigned char *)malloc(size);
-    memcpy(data, fileContent, size);  // dados
+// Constrói o pacote de controlo de tipo controlField do ficheiro source, enviado no fluxo 'stream', na próxima posição do anel
+void publishControlPacket(PacketRing *ring, unsigned char controlField, const SourceFile *source, int stream) {
+    int controlPacketSize;
+    unsigned char *controlPacket = buildControlPacket(controlField, source->size, source->name, source->transferId, source->fingerprint, stream, &controlPacketSize);
+    memcpy(ringAcquire(ring), controlPacket, controlPacketSize);
+    ringPublish(ring, controlPacketSize);
+    free(controlPacket);
+}
 
+// Abre o ficheiro fileIndex no fluxo livre streamId e publica o seu pacote 'start' (exceto no primeiro, se já foi enviado)
+// Retorna 1 em caso de sucesso, -1 se não for possível abrir o ficheiro
+int openStream(Producer *args, Stream *stream, int streamId, int fileIndex) {
+    SourceFile *source = &args->files[fileIndex];
+    stream->file = fopen(source->path, "rb");
+    if (stream->file == NULL) return -1;
+    setvbuf(stream->file, NULL, _IONBF, 0);  // o ficheiro é lido diretamente para staging
+    posix_fadvise(fileno(stream->file), 0, 0, POSIX_FADV_SEQUENTIAL);  // o ficheiro é lido uma vez, do início ao fim
+    stream->offset = stream->readOffset = fileIndex == 0 ? args->offset : 0;
+    fseeko(stream->file, stream->offset, SEEK_SET);
+    stream->stagedStart = 0;
+    stream->stagedEnd = 0;
+    stream->deficit = 0;
+    stream->source = source;
+
+    if (fileIndex > 0 || args->sendFirstStart) {
+        source->fingerprint = fileFingerprint(fileno(stream->file), source->size, source->modified);
+        publishControlPacket(args->ring, CONTROL_PACKET_START, source, streamId);
+    }
+    return 1;
+}
+
+/**
+ * Constrói o próximo pacote de dados de um fluxo diretamente na próxima posição do anel
+ * @param args argumentos da thread produtora
+ * @param stream fluxo
+ * @param streamId identificação do fluxo
+ * @param size tamanho máximo dos dados do pacote
+ * @return número de bytes de dados do pacote, ou -1 se a leitura do ficheiro falhar
+ *
+ * @details
+ * O pacote é preenchido com os dados comprimidos ou, se eles não diminuírem, com os bytes do ficheiro
+ * (o último pode ser 'incompleto')
+ */
+int buildStreamPacket(Producer *args, Stream *stream, int streamId, int size) {
+    SourceFile *source = stream->source;
+    // Manter em staging pelo menos MAX_RAW_CHUNK_SIZE bytes por enviar (ou o resto do ficheiro)
+    if (stream->stagedEnd - stream->stagedStart < MAX_RAW_CHUNK_SIZE && stream->readOffset < source->size) {
+        memmove(stream->staging, stream->staging + stream->stagedStart, stream->stagedEnd - stream->stagedStart);
+        stream->stagedEnd -= stream->stagedStart;
+        stream->stagedStart = 0;
+        int readSize = READ_BUFFER_SIZE - stream->stagedEnd;
+        if (readSize > source->size - stream->readOffset) readSize = source->size - stream->readOffset;
+        if (fread(stream->staging + stream->stagedEnd, sizeof(unsigned char), readSize, stream->file) != (size_t)readSize) return -1;
+        stream->stagedEnd += readSize;
+        stream->readOffset += readSize;
+    }
+    int available = stream->stagedEnd - stream->stagedStart;
+    unsigned char *staged = stream->staging + stream->stagedStart;
+
+    unsigned char *dataPacket = ringAcquire(args->ring);
+    int consumed = 0;
+    int compressedSize = 0;
+    if (COMPRESSION) {
+        compressedSize = lzCompress(staged, available < MAX_RAW_CHUNK_SIZE ? available : MAX_RAW_CHUNK_SIZE,
+                                    dataPacket + dataPacketHeaderSize(stream->offset, TRUE, streamId), size, &consumed);
+    }
     int dataPacketSize;
-    unsigned char *dataPacket = buildDataPacket(size, data, &dataPacketSize);
+    int dataBytes;
+    if (consumed > size) {
+        dataPacketSize = buildDataPacket(compressedSize, stream->offset, consumed, streamId, dataPacket);
+        dataBytes = compressedSize;
+    } else {
+        // Os dados não diminuem com a compressão: seguem tal como estão no ficheiro
+        consumed = size < available ? size : available;
+        memcpy(dataPacket + dataPacketHeaderSize(stream->offset, FALSE, streamId), staged, consumed);
+        dataPacketSize = buildDataPacket(consumed, stream->offset, 0, streamId, dataPacket);
+        dataBytes = consumed;
+    }
+    ringPublish(args->ring, dataPacketSize);
+    stream->stagedStart += consumed;
+    stream->offset += consumed;
+    args->fileBytes += consumed;
+    args->dataBytes += dataBytes;
+    return dataBytes;
+}
+
+/**
+ * Thread produtora: lê os ficheiros em blocos e constrói os pacotes diretamente nas posições do anel
+ * @param arg argumentos (Producer)
+ * @return NULL
+ *
+ * @details
+ * Cada ficheiro dá origem aos pacotes 'start' (exceto o primeiro, se já foi enviado), de dados e 'end'. Até MAX_STREAMS
+ * ficheiros são enviados ao mesmo tempo, cada um num fluxo; quando um termina, o fluxo passa ao ficheiro seguinte.
+ * Deficit round-robin: na sua vez, cada fluxo recebe prioridade x tamanho dos dados bytes e envia pacotes enquanto tiver
+ * pelo menos o tamanho de um pacote, guardando o resto para a volta seguinte, pelo que cada fluxo recebe uma parte
+ * da ligação proporcional à sua prioridade. Um ajuste do tamanho dos dados só afeta os pacotes construídos depois dele.
+ * No fim do último ficheiro é publicado um pacote de tamanho 0, ou -1 se a leitura falhar
+ */
+void *producer(void *arg) {
+    Producer *args = (Producer *)arg;
+    Stream streams[MAX_STREAMS];
+    int streamCount = args->fileCount < MAX_STREAMS ? args->fileCount : MAX_STREAMS;
+    for (int i = 0; i < streamCount; i++) {
+        streams[i].source = NULL;
+        streams[i].staging = (unsigned char *)malloc(READ_BUFFER_SIZE);
+    }
+
+    int nextFile = 0;  // próximo ficheiro a abrir
+    int active = 0;    // fluxos com um ficheiro
+    int current = 0;   // fluxo da vez
+    int failed = FALSE;
+    while (!failed) {
+        // Os fluxos livres passam aos ficheiros seguintes
+        for (int i = 0; i < streamCount && nextFile < args->fileCount; i++) {
+            if (streams[i].source != NULL) continue;
+            if (openStream(args, &streams[i], i, nextFile++) < 0) {
+                failed = TRUE;
+                break;
+            }
+            active++;
+        }
+        if (failed || active == 0) break;
+
+        Stream *stream = &streams[current];
+        int streamId = current;
+        current = (current + 1) % streamCount;
+        if (stream->source == NULL) continue;
+
+        int size = atomic_load(args->dataSize);
+        stream->deficit += size * stream->source->priority;
+        while (stream->offset < stream->source->size && stream->deficit >= size) {
+            int dataBytes = buildStreamPacket(args, stream, streamId, size);
+            if (dataBytes < 0) {
+                failed = TRUE;
+                break;
+            }
+            stream->deficit -= dataBytes;
+            size = atomic_load(args->dataSize);
+        }
+        if (!failed && stream->offset >= stream->source->size) {
+            publishControlPacket(args->ring, CONTROL_PACKET_END, stream->source, streamId);
+            fclose(stream->file);
+            stream->source = NULL;
+            active--;
+        }
+    }
+
+    for (int i = 0; i < streamCount; i++) {
+        if (streams[i].source != NULL) fclose(streams[i].file);
+        free(streams[i].staging);
+    }
+    ringAcquire(args->ring);
+    ringPublish(args->ring, failed ? -1 : 0);
+    return NULL;
+}
 
-    if (llwrite(dataPacket, dataPacketSize) < 0) {
-        printf("Erro a enviar um pacote de dados com %d bytes\n", dataPacketSize);
+// Envia um pacote construído pela thread produtora
+// Os pacotes de dados seguem pela primeira ligação livre; os de controlo pela ligação de controlo, depois de confirmados os dados
+void sendPacket(Bond *bond, unsigned char *packet, int packetSize) {
+    if (packet[0] == DATA_PACKET) printAL("Pacote de Dados Construído", packet, packetSize);  // DEBUG
+
+    if ((packet[0] == DATA_PACKET ? bondSend(bond, packet, packetSize) : bondSendControl(bond, packet, packetSize)) < 0) {
+        printf("Erro a enviar um pacote com %d bytes\n", packetSize);
         exit(-1);
     }
+}
 
-    free(data);
+/**
+ * Ajusta o tamanho dos dados dos pacotes de dados à taxa de erros observada pela camada de ligação desde o último ajuste
+ * @param bond ligações (com várias portas série, a taxa de erros é a do conjunto)
+ * @param dataSize tamanho atual
+ * @param maxDataSize tamanho máximo, dado pelo campo de informação máximo negociado em bondOpen
+ * @param previous contadores da camada de ligação no último ajuste (atualizados)
+ * @return novo tamanho
+ *
+ * @details
+ * As retransmissões incluem as tramas rejeitadas pelo recetor por erros no BCC2/FCS (REJ/SREJ) e as que se perderam (timeout).
+ * Sem retransmissões o tamanho aumenta 50%, amortizando melhor o cabeçalho, as confirmações e o tempo de resposta;
+ * com mais de ERROR_RATE_HIGH% de tramas retransmitidas o tamanho passa para metade, porque a probabilidade de uma trama
+ * ter erros e o custo de a retransmitir crescem com o seu tamanho
+ */
+int adaptDataSize(Bond *bond, int dataSize, int maxDataSize, LinkStatistics *previous) {
+    LinkStatistics current;
+    bondStatistics(bond, &current);
+    int frames = current.framesSent - previous->framesSent;
+    int retransmissions = current.retransmissions - previous->retransmissions;
+    *previous = current;
+    if (frames == 0) return dataSize;
+
+    int newSize = dataSize;
+    if (retransmissions == 0) newSize = dataSize + dataSize / 2;
+    else if (100 * retransmissions > ERROR_RATE_HIGH * frames) newSize = dataSize / 2;
+    if (newSize > maxDataSize) newSize = maxDataSize;
+    if (newSize < MIN_DATA_SIZE) newSize = MIN_DATA_SIZE;
+
+    if (newSize != dataSize) printf("Tamanho dos dados dos pacotes de dados: %d bytes\n", newSize);  // DEBUG
+    return newSize;
 }
 
-// Lê e interpreta um pacote de controlo, retirando o tamanho do ficheiro e retornando o nome do ficheiro
-char *parseControlPacket(unsigned char *packet, int *fileSize) {
-    unsigned char fileSizeLength = packet[2];
+// Lê e interpreta um pacote de controlo de tamanho packetSize, retirando o tamanho do ficheiro, a identificação da transferência,
+// a impressão digital do ficheiro e o fluxo, e retornando o nome do ficheiro (os campos ausentes ficam a 0 ou vazios)
+char *parseControlPacket(unsigned char *packet, int packetSize, long long *fileSize, unsigned int *transferId, unsigned int *fingerprint, int *stream) {
     *fileSize = 0;
-    for (unsigned char i = 3; i < (fileSizeLength + 3); i++) {
-        *fileSize |= packet[i];
-        *fileSize <<= 8;
+    *transferId = 0;
+    *fingerprint = 0;
+    *stream = 0;
+    char *fileName = (char *)malloc(256);
+    fileName[0] = '\0';
+
+    int index = 1;
+    while (index + 2 <= packetSize && index + 2 + packet[index + 1] <= packetSize) {
+        unsigned char type = packet[index];
+        unsigned char length = packet[index + 1];
+        unsigned char *value = packet + index + 2;
+        if (type == CONTROL_PACKET_FILE_SIZE && length <= MAX_NUMBER_LENGTH) {
+            *fileSize = decodeNumber(value, length);
+        } else if (type == CONTROL_PACKET_FILE_NAME) {
+            memcpy(fileName, value, length);
+            fileName[length] = '\0';
+        } else if (type == CONTROL_PACKET_TRANSFER_ID && length == 4) {
+            *transferId = decodeNumber(value, length);
+        } else if (type == CONTROL_PACKET_FINGERPRINT && length == 4) {
+            *fingerprint = decodeNumber(value, length);
+        } else if (type == CONTROL_PACKET_STREAM && length == 1 && value[0] < MAX_STREAMS) {
+            *stream = value[0];
+        }
+        index += 2 + length;
     }
-    *fileSize >>= 8;
-    unsigned char fileNameLength = packet[fileSizeLength + 4];
-    char *fileName = (char *)malloc(fileNameLength + 1);
-    memcpy(fileName, packet + fileSizeLength + 5, fileNameLength);
 
-    printAL("Pacote de Controlo Recebido", packet, fileSizeLength + fileNameLength + 5);  // DEBUG
+    printAL("Pacote de Controlo Recebido", packet, packetSize);  // DEBUG
 
     return fileName;
 }
 
+// Constrói um pacote 'resume' em packet, com a identificação da transferência e a posição a partir da qual ela continua
+// Retorna o tamanho do pacote
+int buildResumePacket(unsigned int transferId, long long resumeOffset, unsigned char *packet) {
+    unsigned char offsetLength = numberLength(resumeOffset);
+    packet[0] = CONTROL_PACKET_RESUME;               // C
+    packet[1] = CONTROL_PACKET_TRANSFER_ID;          // T1
+    packet[2] = 4;                                   // L1
+    encodeNumber(transferId, 4, packet + 3);         // V1 - identificação da transferência
+    packet[7] = CONTROL_PACKET_RESUME_OFFSET;        // T2
+    packet[8] = offsetLength;                        // L2
+    encodeNumber(resumeOffset, offsetLength, packet + 9);  // V2 - posição
+
+    printAL("Pacote de Controlo Construído", packet, 9 + offsetLength);  // DEBUG
+
+    return 9 + offsetLength;
+}
+
+// Lê e interpreta um pacote 'resume' de tamanho packetSize, retirando a posição a partir da qual a transferência continua
+// Retorna 1 se o pacote for válido e se referir à transferência transferId, -1 caso contrário
+int parseResumePacket(unsigned char *packet, int packetSize, unsigned int transferId, long long *resumeOffset) {
+    if (packetSize < 9 || packet[0] != CONTROL_PACKET_RESUME) return -1;
+    if (packet[1] != CONTROL_PACKET_TRANSFER_ID || packet[2] != 4 || decodeNumber(packet + 3, 4) != transferId) return -1;
+    if (packet[7] != CONTROL_PACKET_RESUME_OFFSET || packet[8] > MAX_NUMBER_LENGTH || 9 + packet[8] > packetSize) return -1;
+    *resumeOffset = decodeNumber(packet + 9, packet[8]);
+
+    printAL("Pacote de Controlo Recebido", packet, packetSize);  // DEBUG
+
+    return 1;
+}
+
+// Escreve em packet + index um TLV do tipo 'type' com n em 'length' bytes
+// Retorna a posição a seguir ao TLV
+int appendNumberTlv(unsigned char *packet, int index, unsigned char type, unsigned long long n, unsigned char length) {
+    packet[index++] = type;
+    packet[index++] = length;
+    encodeNumber(n, length, packet + index);
+    return index + length;
+}
+
+// Constrói um pacote 'manifest' em packet, com o número de ficheiros do lote, a soma dos seus tamanhos, a identificação
+// do lote e a impressão digital da lista de ficheiros
+// Retorna o tamanho do pacote
+int buildManifestPacket(int fileCount, long long totalSize, unsigned int batchId, unsigned int fingerprint, unsigned char *packet) {
+    packet[0] = CONTROL_PACKET_MANIFEST;  // C
+    int index = appendNumberTlv(packet, 1, CONTROL_PACKET_FILE_COUNT, fileCount, numberLength(fileCount));
+    index = appendNumberTlv(packet, index, CONTROL_PACKET_TOTAL_SIZE, totalSize, numberLength(totalSize));
+    index = appendNumberTlv(packet, index, CONTROL_PACKET_TRANSFER_ID, batchId, 4);
+    index = appendNumberTlv(packet, index, CONTROL_PACKET_FINGERPRINT, fingerprint, 4);
+
+    printAL("Pacote de Controlo Construído", packet, index);  // DEBUG
+
+    return index;
+}
+
+// Lê e interpreta um pacote 'manifest' de tamanho packetSize
+// Retorna 1 se o pacote for válido (com o número de ficheiros), -1 caso contrário
+int parseManifestPacket(unsigned char *packet, int packetSize, int *fileCount, long long *totalSize, unsigned int *batchId, unsigned int *fingerprint) {
+    if (packetSize < 1 || packet[0] != CONTROL_PACKET_MANIFEST) return -1;
+    *fileCount = -1;
+    *totalSize = 0;
+    *batchId = 0;
+    *fingerprint = 0;
+
+    int index = 1;
+    while (index + 2 <= packetSize && index + 2 + packet[index + 1] <= packetSize) {
+        unsigned char type = packet[index];
+        unsigned char length = packet[index + 1];
+        unsigned char *value = packet + index + 2;
+        if (type == CONTROL_PACKET_FILE_COUNT && length <= 4) {
+            *fileCount = decodeNumber(value, length);
+        } else if (type == CONTROL_PACKET_TOTAL_SIZE && length <= MAX_NUMBER_LENGTH) {
+            *totalSize = decodeNumber(value, length);
+        } else if (type == CONTROL_PACKET_TRANSFER_ID && length == 4) {
+            *batchId = decodeNumber(value, length);
+        } else if (type == CONTROL_PACKET_FINGERPRINT && length == 4) {
+            *fingerprint = decodeNumber(value, length);
+        }
+        index += 2 + length;
+    }
+
+    printAL("Pacote de Controlo Recebido", packet, packetSize);  // DEBUG
+
+    return *fileCount >= 0 ? 1 : -1;
+}
+
+/**
+ * Lista os ficheiros regulares de uma diretoria, para serem enviados num lote
+ * @param directory diretoria
+ * @param files ficheiros encontrados, por ordem do nome (alocados com malloc)
+ * @return número de ficheiros, ou -1 em caso de erro
+ *
+ * @details
+ * A ordem é a mesma em cada execução, pelo que o número de ficheiros completos guardado pelo recetor identifica
+ * os ficheiros que não voltam a ser enviados. As subdiretorias não são enviadas
+ */
+int listDirectory(const char *directory, SourceFile **files) {
+    struct dirent **entries;
+    int entryCount = scandir(directory, &entries, NULL, alphasort);
+    if (entryCount < 0) return -1;
+
+    *files = (SourceFile *)malloc((entryCount > 0 ? entryCount : 1) * sizeof(SourceFile));
+    int fileCount = 0;
+    for (int i = 0; i < entryCount; i++) {
+        int nameLength = strlen(entries[i]->d_name);
+        char *path = (char *)malloc(strlen(directory) + nameLength + 2);
+        sprintf(path, "%s/%s", directory, entries[i]->d_name);
+        free(entries[i]);
+
+        struct stat st;
+        if (nameLength > 255 || stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        SourceFile *source = &(*files)[fileCount++];
+        source->path = path;
+        source->name = path + strlen(directory) + 1;
+        source->size = st.st_size;
+        source->modified = st.st_mtime;
+        source->transferId = crc32((const unsigned char *)source->name, nameLength);
+        source->fingerprint = 0;
+        source->priority = 1;
+    }
+    free(entries);
+    return fileCount;
+}
+
+/**
+ * Interpreta uma lista de ficheiros separados por vírgulas, para serem enviados num lote
+ * @param list lista, em que cada ficheiro pode ter a sua prioridade depois de PRIORITY_SEPARATOR (1 se não tiver)
+ * @param files ficheiros da lista, pela mesma ordem (alocados com malloc)
+ * @return número de ficheiros, ou -1 se algum não for um ficheiro regular, tiver uma prioridade inválida ou um nome repetido
+ *
+ * @details
+ * Cada ficheiro é enviado com o seu nome sem a diretoria, pelo que o recetor os escreve todos na mesma diretoria
+ */
+int listFiles(const char *list, SourceFile **files) {
+    int entryCount = 1;
+    for (const char *c = list; *c != '\0'; c++) {
+        if (*c == ',') entryCount++;
+    }
+    *files = (SourceFile *)malloc(entryCount * sizeof(SourceFile));
+
+    int fileCount = 0;
+    const char *entry = list;
+    while (fileCount < entryCount) {
+        const char *entryEnd = strchr(entry, ',');
+        int entryLength = entryEnd != NULL ? entryEnd - entry : (int)strlen(entry);
+        char *path = strndup(entry, entryLength);
+        entry += entryLength + 1;
+
+        int priority = 1;
+        char *separator = strrchr(path, PRIORITY_SEPARATOR);
+        if (separator != NULL) {
+            char *end;
+            priority = strtol(separator + 1, &end, 10);
+            *separator = '\0';
+            if (end == separator + 1 || *end != '\0' || priority < 1 || priority > MAX_PRIORITY) priority = -1;
+        }
+        const char *name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+
+        int repeated = FALSE;  // dois ficheiros com o mesmo nome seriam escritos no mesmo ficheiro do recetor
+        for (int i = 0; i < fileCount; i++) {
+            if (strcmp((*files)[i].name, name) == 0) repeated = TRUE;
+        }
+        struct stat st;
+        if (priority < 0 || repeated || strlen(name) > 255 || stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            for (int i = 0; i < fileCount; i++) free((*files)[i].path);
+            free(*files);
+            return -1;
+        }
+        SourceFile *source = &(*files)[fileCount++];
+        source->path = path;
+        source->name = name;
+        source->size = st.st_size;
+        source->modified = st.st_mtime;
+        source->transferId = crc32((const unsigned char *)name, strlen(name));
+        source->fingerprint = 0;
+        source->priority = priority;
+    }
+    return fileCount;
+}
+
+// Calcula a impressão digital de um lote: CRC-32 do nome, do tamanho e do instante da última modificação de cada ficheiro
+unsigned int batchFingerprint(const SourceFile *files, int fileCount) {
+    unsigned int crc = 0xFFFFFFFF;
+    for (int i = 0; i < fileCount; i++) {
+        unsigned char header[16];
+        encodeNumber(files[i].size, 8, header);
+        encodeNumber(files[i].modified, 8, header + 8);
+        crc = crc32Update(crc, (const unsigned char *)files[i].name, strlen(files[i].name) + 1);
+        crc = crc32Update(crc, header, sizeof(header));
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+// Calcula a identificação de um lote: CRC-32 dos nomes enviados, pela ordem do lote
+// Não depende da forma como a diretoria ou a lista foi escrita, pelo que o lote é retomado a partir de outra diretoria de trabalho
+unsigned int batchTransferId(const SourceFile *files, int fileCount) {
+    unsigned int crc = 0xFFFFFFFF;
+    for (int i = 0; i < fileCount; i++) crc = crc32Update(crc, (const unsigned char *)files[i].name, strlen(files[i].name) + 1);
+    return crc ^ 0xFFFFFFFF;
+}
+
+// Verifica se o nome recebido num lote designa um ficheiro da diretoria (e não, por exemplo, "../x")
+int validBatchName(const char *name) {
+    return name[0] != '\0' && strchr(name, '/') == NULL && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+// Guarda o checkpoint da transferência: os dados até à posição 'committed' estão no disco
+// O checkpoint é escrito num ficheiro temporário que depois substitui o anterior, pelo que nunca fica incompleto
+void saveCheckpoint(const char *checkpointName, unsigned int transferId, unsigned int fingerprint, long long committed) {
+    unsigned char record[CHECKPOINT_SIZE];
+    encodeNumber(transferId, 4, record);
+    encodeNumber(fingerprint, 4, record + 4);
+    encodeNumber(committed, 8, record + 8);
+
+    char temporaryName[strlen(checkpointName) + 5];
+    sprintf(temporaryName, "%s.tmp", checkpointName);
+    int fd = open(temporaryName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return;  // sem checkpoint, uma nova transferência recomeça do início
+    int ok = write(fd, record, sizeof(record)) == sizeof(record) && fdatasync(fd) == 0;
+    close(fd);
+    if (ok) rename(temporaryName, checkpointName);
+}
+
+// Retorna a posição guardada no checkpoint, se ele corresponder à transferência transferId do ficheiro com a impressão digital dada,
+// ou 0 caso contrário
+long long loadCheckpoint(const char *checkpointName, unsigned int transferId, unsigned int fingerprint) {
+    unsigned char record[CHECKPOINT_SIZE];
+    int fd = open(checkpointName, O_RDONLY);
+    if (fd < 0) return 0;
+    int size = read(fd, record, sizeof(record));
+    close(fd);
+    if (size != sizeof(record)) return 0;
+    if (decodeNumber(record, 4) != transferId || decodeNumber(record + 4, 4) != fingerprint) return 0;
+    return decodeNumber(record + 8, 8);
+}
+
+// Escreve 'size' bytes de batch no ficheiro, a partir da posição offset
+// Retorna 1 em caso de sucesso, -1 em caso de erro
+int writeBatch(int fd, const unsigned char *batch, int size, off_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, batch, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        batch += written;
+        size -= written;
+        offset += written;
+    }
+    return 1;
+}
+
+// Ficheiro mapeado pelo recetor e posição até à qual os dados estão no disco, para o cortar se a transferência terminar antes do fim
+atomic_int mappedFd = -1;
+atomic_llong mappedCommitted;
+
+// Corta o ficheiro mapeado na posição dos dados no disco (à saída do processo)
+void truncateMappedFile(void) {
+    int fd = atomic_load(&mappedFd);
+    if (fd >= 0) ftruncate(fd, atomic_load(&mappedCommitted));
+}
+
+// Corta o ficheiro mapeado e termina o processo com o sinal recebido, como sem o mapeamento
+void truncateMappedFileOnSignal(int signalNumber) {
+    truncateMappedFile();
+    signal(signalNumber, SIG_DFL);
+    raise(signalNumber);
+}
+
+// Escreve o bloco de dados de um fluxo no ficheiro e, se ele continuar os dados já no disco (até 'committed'),
+// avança 'committed' e atualiza o checkpoint da transferência (num lote, o checkpoint só avança no fim de cada ficheiro)
+// Com o ficheiro mapeado, os dados já estão no ficheiro e só é preciso levá-los para o disco antes do checkpoint
+void commitBatch(Writer *args, StreamWriter *stream) {
+    if (stream->map == NULL && writeBatch(stream->fd, stream->batch, stream->batchSize, stream->offset) < 0) {
+        printf("Erro a escrever no ficheiro\n");
+        exit(-1);
+    }
+    if (stream->batchSize > 0 && stream->offset == stream->committed) {
+        stream->committed += stream->batchSize;
+        if (args->directory != NULL) return;
+        // os dados têm de estar no disco antes do checkpoint que os declara
+        if (stream->map != NULL) {
+            long long pageStart = stream->offset & ~((long long)sysconf(_SC_PAGESIZE) - 1);  // msync só aceita páginas inteiras
+            msync(stream->map + pageStart, stream->offset + stream->batchSize - pageStart, MS_SYNC);
+        } else {
+            fdatasync(stream->fd);
+        }
+        saveCheckpoint(args->checkpointName, args->transferId, args->fingerprint, stream->committed);
+        if (stream->map != NULL) atomic_store(&mappedCommitted, stream->committed);
+    }
+}
+
+// Inverte a ligação e espera pela resposta do recetor ao pacote 'start' ou 'manifest' da transferência transferId
+// Retorna a posição (ou, num lote, o número de ficheiros) a partir da qual a transferência continua
+long long waitResume(LinkHandle *control, unsigned int transferId) {
+    if (linkFlush(control) < 0) {
+        printf("Erro a enviar pacote de controlo\n");
+        exit(-1);
+    }
+    long long resumeOffset = 0;
+    unsigned char *resumePacket = (unsigned char *)malloc(MAX_PAYLOAD_SIZE);
+    while (TRUE) {
+        int resumePacketSize = linkRead(control, resumePacket);
+        if (resumePacketSize < 0 && linkHungUp(control)) {
+            printf("Erro a receber pacote de controlo 'resume'\n");
+            exit(-1);
+        }
+        if (resumePacketSize > 0 && parseResumePacket(resumePacket, resumePacketSize, transferId, &resumeOffset) > 0) break;
+    }
+    free(resumePacket);
+    return resumeOffset;
+}
+
+// Passa (com o lock) um pacote à thread escritora
+void reassemblerForward(Reassembler *reassembler, const unsigned char *packet, int packetSize) {
+    if (packetSize > 0) memcpy(ringAcquire(reassembler->ring), packet, packetSize);
+    else ringAcquire(reassembler->ring);
+    ringPublish(reassembler->ring, packetSize);
+}
+
+// Passa (com o lock) os pacotes guardados do fluxo 'stream' que continuam os dados já passados e descarta os repetidos
+void reassemblerDrain(Reassembler *reassembler, int stream) {
+    ReorderedPacket **position = &reassembler->packets;
+    while (*position != NULL && (*position)->stream < stream) position = &(*position)->next;
+    while (reassembler->started[stream] && *position != NULL && (*position)->stream == stream && (*position)->offset <= reassembler->nextOffset[stream]) {
+        ReorderedPacket *first = *position;
+        if (first->offset == reassembler->nextOffset[stream]) {
+            reassemblerForward(reassembler, first->packet, first->packetSize);
+            reassembler->nextOffset[stream] += first->chunkSize;
+        }
+        *position = first->next;
+        free(first);
+    }
+    pthread_cond_broadcast(&reassembler->changed);
+}
+
+/**
+ * Recebe um pacote de dados de uma das ligações (BondDeliver)
+ * @param context reordenação (Reassembler)
+ * @param packet pacote recebido
+ * @param packetSize tamanho do pacote
+ *
+ * @details
+ * O pacote passa logo se continuar os dados já passados do seu fluxo; caso contrário fica guardado até chegarem os anteriores.
+ * Nunca espera, pelo que a ligação continua a ler e a confirmar as suas tramas. Os pacotes com dados já passados ou já guardados são repetições (reenviados por outra ligação depois de uma falha)
+ * e são descartados
+ */
+void reassemblerDeliver(void *context, unsigned char *packet, int packetSize) {
+    Reassembler *reassembler = (Reassembler *)context;
+    if (packetSize <= 0 || packet[0] != DATA_PACKET) return;
+
+    pthread_mutex_lock(&reassembler->lock);
+    long long offset = -1;
+    int dataSize;
+    int rawSize;
+    int stream;
+    if (parseDataPacket(packet, packetSize, &offset, &dataSize, &rawSize, &stream) < 0) {
+        pthread_mutex_unlock(&reassembler->lock);
+        return;
+    }
+    if (offset < 0) offset = reassembler->nextOffset[stream];  // um pacote sem posição continua os dados anteriores
+    int chunkSize = rawSize > 0 ? rawSize : dataSize;
+    if (reassembler->started[stream] && offset < reassembler->nextOffset[stream]) {
+        pthread_mutex_unlock(&reassembler->lock);  // repetido
+        return;
+    }
+    if (reassembler->started[stream] && offset == reassembler->nextOffset[stream]) {
+        reassemblerForward(reassembler, packet, packetSize);
+        reassembler->nextOffset[stream] += chunkSize;
+        reassemblerDrain(reassembler, stream);
+        pthread_mutex_unlock(&reassembler->lock);
+        return;
+    }
+
+    ReorderedPacket **position = &reassembler->packets;
+    while (*position != NULL && ((*position)->stream < stream || ((*position)->stream == stream && (*position)->offset < offset))) {
+        position = &(*position)->next;
+    }
+    if (*position != NULL && (*position)->stream == stream && (*position)->offset == offset) {
+        pthread_mutex_unlock(&reassembler->lock);  // repetido
+        return;
+    }
+    ReorderedPacket *reordered = (ReorderedPacket *)malloc(sizeof(ReorderedPacket) + packetSize);
+    reordered->next = *position;
+    reordered->stream = stream;
+    reordered->offset = offset;
+    reordered->chunkSize = chunkSize;
+    reordered->packetSize = packetSize;
+    memcpy(reordered->packet, packet, packetSize);
+    *position = reordered;
+    pthread_mutex_unlock(&reassembler->lock);
+}
+
+/**
+ * Passa um pacote de controlo recebido pela ligação de controlo (ou o pacote de tamanho 0 do fim da transferência)
+ * @param reassembler reordenação
+ * @param packet pacote recebido
+ * @param packetSize tamanho do pacote
+ * @param startOffset num pacote 'start', posição dos primeiros dados do ficheiro
+ *
+ * @details
+ * O 'start' passa os dados do ficheiro que já tinham chegado pelo seu fluxo. O 'end' espera que passem todos os dados
+ * do ficheiro: o emissor só o envia depois de confirmados os dados, mas as threads das outras ligações podem ainda
+ * não os ter entregue
+ */
+void reassemblerPublish(Reassembler *reassembler, unsigned char *packet, int packetSize, long long startOffset) {
+    long long fileSize = 0;
+    int stream = 0;
+    if (packetSize > 0 && (packet[0] == CONTROL_PACKET_START || packet[0] == CONTROL_PACKET_END)) {
+        unsigned int transferId;
+        unsigned int fingerprint;
+        free(parseControlPacket(packet, packetSize, &fileSize, &transferId, &fingerprint, &stream));
+    }
+
+    pthread_mutex_lock(&reassembler->lock);
+    if (packetSize > 0 && packet[0] == CONTROL_PACKET_END) {
+        while (reassembler->nextOffset[stream] < fileSize) pthread_cond_wait(&reassembler->changed, &reassembler->lock);
+    }
+    reassemblerForward(reassembler, packet, packetSize);
+    if (packetSize > 0 && packet[0] == CONTROL_PACKET_START) {
+        reassembler->started[stream] = TRUE;
+        reassembler->nextOffset[stream] = startOffset;
+        reassemblerDrain(reassembler, stream);
+    } else if (packetSize > 0 && packet[0] == CONTROL_PACKET_END) {
+        // Os dados do ficheiro seguinte do fluxo só são enviados depois deste 'end'; os que restam são repetições
+        reassembler->started[stream] = FALSE;
+        reassembler->nextOffset[stream] = 0;
+        ReorderedPacket **position = &reassembler->packets;
+        while (*position != NULL) {
+            ReorderedPacket *first = *position;
+            if (first->stream != stream) {
+                position = &first->next;
+                continue;
+            }
+            *position = first->next;
+            free(first);
+        }
+        pthread_cond_broadcast(&reassembler->changed);
+    }
+    pthread_mutex_unlock(&reassembler->lock);
+}
+
+/**
+ * Escolhe o destino dos dados de um pacote recebido com linkReadPlaced (LinkPlacement)
+ * @param context destino (Placement)
+ * @param header primeiros headerSize bytes do pacote, ainda por verificar
+ * @param headerSize tamanho previsto do cabeçalho: o de um pacote de dados com os dados na posição esperada, comprimido
+ * se o anterior o estava (um pacote com outro cabeçalho fica no pacote)
+ * @param capacity número de bytes de dados do pacote
+ * @return posição do ficheiro mapeado onde os dados são colocados, ou NULL se ficarem no pacote
+ *
+ * @details
+ * Os dados só vão para o ficheiro se o pacote não estiver comprimido e continuar os dados já recebidos
+ */
+unsigned char *placeData(void *context, const unsigned char *header, int headerSize, int *capacity) {
+    Placement *placement = (Placement *)context;
+    if (header[0] != DATA_PACKET) return NULL;
+    long long offset = -1;
+    int dataSize;
+    int rawSize;
+    int stream;
+    if (parseDataPacket(header, headerSize + header[1] * 256 + header[2], &offset, &dataSize, &rawSize, &stream) != headerSize) return NULL;
+    if (rawSize > 0 || stream != 0 || offset != placement->nextOffset || offset + dataSize > placement->mapSize) return NULL;
+
+    memcpy(placement->header, header, headerSize);
+    placement->headerSize = headerSize;
+    placement->destination = placement->map + offset;
+    *capacity = dataSize;
+    return placement->destination;
+}
+
+/**
+ * Confirma o destino dos dados de um pacote de dados recebido com linkReadPlaced e avança a posição esperada
+ * @param placement destino
+ * @param packet pacote recebido (passa a PLACED_DATA_PACKET se os dados estiverem no ficheiro)
+ * @param packetSize tamanho do pacote
+ * @param placed TRUE se a camada de ligação colocou os dados no destino escolhido por placeData
+ *
+ * @details
+ * Se o FEC corrigiu o cabeçalho depois de escolhido o destino, os dados voltam para o pacote, que segue como os outros
+ */
+void confirmPlacement(Placement *placement, unsigned char *packet, int packetSize, int placed) {
+    if (placed && memcmp(packet, placement->header, placement->headerSize) != 0) {
+        memcpy(packet + placement->headerSize, placement->destination, packetSize - placement->headerSize);
+        placed = FALSE;
+    }
+    long long offset = placement->nextOffset;  // um pacote sem posição continua os dados anteriores
+    int dataSize;
+    int rawSize;
+    int stream;
+    if (parseDataPacket(packet, packetSize, &offset, &dataSize, &rawSize, &stream) >= 0 && stream == 0) {
+        placement->nextOffset = offset + (rawSize > 0 ? rawSize : dataSize);
+        placement->compressed = rawSize > 0;
+    }
+    if (placed) packet[0] = PLACED_DATA_PACKET;
+}
+
+/**
+ * Thread escritora: interpreta os pacotes recebidos pela camada de ligação e escreve os dados nos ficheiros
+ * @param arg argumentos (Writer)
+ * @return NULL
+ *
+ * @details
+ * O pacote 'start' reserva o espaço do ficheiro com fallocate (sem alterar o seu tamanho, pelo que uma transferência
+ * interrompida não deixa zeros no fim; o ficheiro mapeado é cortado à saída do processo); num lote, abre também o ficheiro na diretoria do
+ * lote. Cada fluxo tem o seu ficheiro e o seu bloco. Os dados são escritos na posição indicada em cada pacote; os pacotes
+ * com dados contíguos são acumulados num bloco escrito com um único pwrite quando fica cheio, quando chega um pacote com
+ * dados de outra posição e no pacote 'end'. Com o ficheiro mapeado, os dados são copiados (ou já foram colocados) na sua
+ * posição do ficheiro e o bloco só indica os dados ainda por levar para o disco.
+ * Depois de cada bloco escrito, o checkpoint guarda a posição até à qual os dados são contíguos e estão no disco;
+ * num lote, os ficheiros terminam por qualquer ordem e o checkpoint guarda o número de ficheiros completos no início
+ * do lote. No fim da transferência o checkpoint é apagado.
+ * A thread termina com o pacote de tamanho 0 publicado depois do último 'end'
+ */
+void *writer(void *arg) {
+    Writer *args = (Writer *)arg;
+    StreamWriter streams[MAX_STREAMS];
+    for (int i = 0; i < MAX_STREAMS; i++) {
+        streams[i] = (StreamWriter){.fd = -1, .map = NULL, .batch = (unsigned char *)malloc(WRITE_BATCH_SIZE), .batchSize = 0, .offset = 0, .committed = 0};
+    }
+    unsigned char *fileDone = NULL;  // num lote, ficheiros já completos no disco
+    int nextFile = 0;                // num lote, posição do ficheiro do próximo 'start'
+
+    while (TRUE) {
+        int packetSize;
+        unsigned char *packet = ringPeek(args->ring, &packetSize);
+        if (packetSize <= 0) {
+            ringRelease(args->ring);
+            break;
+        }
+        if (packet[0] == CONTROL_PACKET_START) {
+            long long fileSize;
+            unsigned int transferId;
+            unsigned int fingerprint;
+            int streamId;
+            char *newFileName = parseControlPacket(packet, packetSize, &fileSize, &transferId, &fingerprint, &streamId);
+            StreamWriter *stream = &streams[streamId];
+            printf("Início da receção do ficheiro %s (%lld bytes)\n", newFileName, fileSize);
+            if (args->directory != NULL) {
+                if (!validBatchName(newFileName)) {
+                    printf("Nome de ficheiro inválido no lote: %s\n", newFileName);
+                    exit(-1);
+                }
+                if (fileDone == NULL) {
+                    fileDone = (unsigned char *)calloc(args->fileCount > 0 ? args->fileCount : 1, 1);
+                    nextFile = args->filesCompleted;
+                }
+                char path[strlen(args->directory) + strlen(newFileName) + 2];
+                sprintf(path, "%s/%s", args->directory, newFileName);
+                stream->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                if (stream->fd < 0) {
+                    printf("Erro a abrir o ficheiro %s para escrever\n", path);
+                    exit(-1);
+                }
+                stream->fileIndex = nextFile++;
+            } else {
+                stream->fd = args->fd;
+                stream->map = args->map;
+                stream->mapSize = args->mapSize;
+            }
+            free(newFileName);
+            if (fileSize > 0) fallocate(stream->fd, FALLOC_FL_KEEP_SIZE, 0, fileSize);  // só uma otimização, pode não ser suportado
+            stream->offset = stream->committed = args->directory == NULL ? args->resumeOffset : 0;
+            stream->batchSize = 0;
+        } else if (packet[0] == DATA_PACKET || packet[0] == PLACED_DATA_PACKET) {
+            long long dataOffset = -1;
+            int dataSize;
+            int rawSize;
+            int streamId;
+            int headerSize = parseDataPacket(packet, packetSize, &dataOffset, &dataSize, &rawSize, &streamId);
+            StreamWriter *stream = &streams[streamId];
+            if (dataOffset < 0) dataOffset = stream->offset + stream->batchSize;  // um pacote sem posição continua os dados anteriores
+            int chunkSize = rawSize > 0 ? rawSize : dataSize;  // bytes do ficheiro
+            if (headerSize >= 0 && stream->fd >= 0 && (stream->map == NULL || dataOffset + chunkSize <= stream->mapSize)) {
+                if (dataOffset != stream->offset + stream->batchSize || stream->batchSize + chunkSize > WRITE_BATCH_SIZE) {
+                    commitBatch(args, stream);
+                    stream->offset = dataOffset;
+                    stream->batchSize = 0;
+                }
+                unsigned char *destination = stream->map != NULL ? stream->map + dataOffset : stream->batch + stream->batchSize;
+                if (packet[0] == PLACED_DATA_PACKET) {
+                    // Os dados já estão no ficheiro mapeado
+                } else if (rawSize == 0) {
+                    memcpy(destination, packet + headerSize, dataSize);
+                } else if (lzDecompress(packet + headerSize, dataSize, destination, chunkSize) != chunkSize) {
+                    printf("Erro a descomprimir um pacote de dados\n");
+                    exit(-1);
+                }
+                stream->batchSize += chunkSize;
+
+                printAL("Pacote de Dados Recebido", packet, packet[0] == PLACED_DATA_PACKET ? headerSize : packetSize);  // DEBUG
+            }
+        } else if (packet[0] == CONTROL_PACKET_END) {
+            long long fileSize;
+            unsigned int transferId;
+            unsigned int fingerprint;
+            int streamId;
+            char *newFileName = parseControlPacket(packet, packetSize, &fileSize, &transferId, &fingerprint, &streamId);
+            StreamWriter *stream = &streams[streamId];
+            printf("Fim da receção do ficheiro %s (%lld bytes)\n", newFileName, fileSize);
+            free(newFileName);
+
+            if (stream->fd >= 0) {
+                commitBatch(args, stream);
+                stream->batchSize = 0;
+                if (args->directory != NULL) {
+                    // O ficheiro tem de estar no disco antes do checkpoint que o declara completo
+                    fdatasync(stream->fd);
+                    close(stream->fd);
+                    if (stream->fileIndex < args->fileCount) fileDone[stream->fileIndex] = TRUE;
+                    int filesCompleted = args->filesCompleted;
+                    while (args->filesCompleted < args->fileCount && fileDone[args->filesCompleted]) args->filesCompleted++;
+                    if (args->filesCompleted == args->fileCount) unlink(args->checkpointName);
+                    else if (args->filesCompleted > filesCompleted) saveCheckpoint(args->checkpointName, args->transferId, args->fingerprint, args->filesCompleted);
+                } else if (stream->committed == fileSize) {
+                    // Transferência completa - o checkpoint deixa de ser necessário
+                    ftruncate(stream->fd, fileSize);
+                    unlink(args->checkpointName);
+                }
+                stream->fd = -1;
+                stream->map = NULL;
+            }
+        }
+        ringRelease(args->ring);
+    }
+
+    for (int i = 0; i < MAX_STREAMS; i++) free(streams[i].batch);
+    free(fileDone);
+    return NULL;
+}
+
 void applicationLayer(const char *serialPort, const char *role, int baudRate, int nTries, int timeout, const char *filename) {
+    // serialPort pode ter várias portas série separadas por vírgulas, pelo que cada uma é copiada por bondOpen
     LinkLayer connectionParameters;
-    strcpy(connectionParameters.serialPort, serialPort);
     if (strcmp(role, "tx") == 0)  // role == "tx"
         connectionParameters.role = LlTx;
     else if (strcmp(role, "rx") == 0)  // role == "rx"
@@ -136,95 +1273,276 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate, in
     connectionParameters.nRetransmissions = nTries;
     connectionParameters.timeout = timeout;
 
-    if (llopen(connectionParameters) < 0) {
-        printf("Erro a estabelecer a ligação\n");
-        exit(-1);
-    }
-
+    Bond *bond;
     if (connectionParameters.role == LlTx) {
-        FILE *file = fopen(filename, "rb");
-        if (file == NULL) {
-            printf("Erro a abrir o ficheiro %s para ler\n", filename);
+        bond = bondOpen(connectionParameters, serialPort, NULL, NULL);
+        if (bond == NULL) {
+            printf("Erro a estabelecer a ligação\n");
             exit(-1);
         }
 
-        long int fileSize;
+        // filename pode ser um ficheiro, uma diretoria ou uma lista de ficheiros separados por vírgulas
         struct stat st;
-        if (stat(filename, &st) == 0) {
-            fileSize = st.st_size;
-            printf("O tamanho do ficheiro é %ld bytes\n", fileSize);  // DEBUG
-        } else {
-            printf("Erro a obter o tamanho do ficheiro\n");
+        int isList = stat(filename, &st) < 0;
+        if (isList && strchr(filename, ',') == NULL && strchr(filename, PRIORITY_SEPARATOR) == NULL) {
+            printf("Erro a abrir o ficheiro %s para ler\n", filename);
             exit(-1);
         }
 
-        // Construir e enviar pacote de controlo 'start'
-        int startControlPacketSize;
-        unsigned char *startControlPacket = buildControlPacket(CONTROL_PACKET_START, fileSize, filename, &startControlPacketSize);
-        if (llwrite(startControlPacket, startControlPacketSize) < 0) {
-            printf("Erro a enviar pacote de controlo 'start'\n");
-            exit(-1);
-        }
+        SourceFile *files;
+        int fileCount;
+        Producer args;
+        if (isList || S_ISDIR(st.st_mode)) {
+            // Lote: um pacote 'manifest' e uma única resposta do recetor, com o número de ficheiros já recebidos
+            fileCount = isList ? listFiles(filename, &files) : listDirectory(filename, &files);
+            if (fileCount < 0) {
+                printf(isList ? "Lista de ficheiros inválida: %s\n" : "Erro a listar a diretoria %s\n", filename);
+                exit(-1);
+            }
+            long long totalSize = 0;
+            for (int i = 0; i < fileCount; i++) totalSize += files[i].size;
+            printf("O lote tem %d ficheiros e %lld bytes\n", fileCount, totalSize);  // DEBUG
 
-        unsigned char *fileContent = (unsigned char *)malloc(fileSize * sizeof(unsigned char));
-        fread(fileContent, sizeof(unsigned char), fileSize, file);
+            unsigned int batchId = batchTransferId(files, fileCount);
+            unsigned char manifestPacket[MAX_MANIFEST_SIZE];
+            int manifestPacketSize = buildManifestPacket(fileCount, totalSize, batchId, batchFingerprint(files, fileCount), manifestPacket);
+            if (bondSendControl(bond, manifestPacket, manifestPacketSize) < 0) {
+                printf("Erro a enviar pacote de controlo 'manifest'\n");
+                exit(-1);
+            }
+            long long filesCompleted = waitResume(bondControl(bond), batchId);
+            if (filesCompleted > fileCount) filesCompleted = 0;
+            if (filesCompleted > 0) printf("A retomar o lote a partir do ficheiro %lld\n", filesCompleted + 1);
 
-        int completePackets = fileSize / MAX_DATA_SIZE;
-        int incompletePacketSize = fileSize % MAX_DATA_SIZE;
+            args = (Producer){.files = files + filesCompleted, .fileCount = fileCount - filesCompleted, .offset = 0, .sendFirstStart = TRUE};
+        } else {
+            int fd = open(filename, O_RDONLY);
+            if (fd < 0) {
+                printf("Erro a abrir o ficheiro %s para ler\n", filename);
+                exit(-1);
+            }
+            fileCount = 1;
+            files = (SourceFile *)malloc(sizeof(SourceFile));
+            // Como num lote, o nome enviado (e a identificação da transferência) não inclui a diretoria,
+            // pelo que o mesmo ficheiro tem a mesma identificação qualquer que seja o caminho usado
+            files[0].path = strdup(filename);
+            files[0].name = strrchr(files[0].path, '/') != NULL ? strrchr(files[0].path, '/') + 1 : files[0].path;
+            files[0].size = st.st_size;
+            files[0].modified = st.st_mtime;
+            files[0].transferId = crc32((const unsigned char *)files[0].name, strlen(files[0].name));
+            files[0].fingerprint = fileFingerprint(fd, st.st_size, st.st_mtime);
+            files[0].priority = 1;
+            close(fd);
+            printf("O tamanho do ficheiro é %lld bytes\n", files[0].size);  // DEBUG
 
-        // Enviar pacotes de dados 'completos'
-        for (int i = 0; i < completePackets; i++) {
-            sendDataPacket(MAX_DATA_SIZE, fileContent);
-            fileContent += MAX_DATA_SIZE;
-        }
+            // Construir e enviar pacote de controlo 'start'
+            int startControlPacketSize;
+            unsigned char *startControlPacket = buildControlPacket(CONTROL_PACKET_START, files[0].size, files[0].name, files[0].transferId, files[0].fingerprint, 0, &startControlPacketSize);
+            if (bondSendControl(bond, startControlPacket, startControlPacketSize) < 0) {
+                printf("Erro a enviar pacote de controlo 'start'\n");
+                exit(-1);
+            }
+            free(startControlPacket);
+
+            // Esperar pela posição a partir da qual a transferência continua
+            long long resumeOffset = waitResume(bondControl(bond), files[0].transferId);
+            if (resumeOffset > files[0].size) resumeOffset = 0;
+            if (resumeOffset > 0) printf("A retomar a transferência a partir do byte %lld\n", resumeOffset);
 
-        // Enviar pacote de dados 'incompleto' (caso exista)
-        if (incompletePacketSize != 0) {
-            sendDataPacket(incompletePacketSize, fileContent);
+            args = (Producer){.files = files, .fileCount = 1, .offset = resumeOffset, .sendFirstStart = FALSE};
         }
 
-        // Construir e enviar pacote de controlo 'end'
-        int endControlPacketSize;
-        unsigned char *endControlPacket = buildControlPacket(CONTROL_PACKET_END, fileSize, filename, &endControlPacketSize);
-        if (llwrite(endControlPacket, endControlPacketSize) < 0) {
-            printf("Erro a enviar pacote de controlo 'end'\n");
+        LinkStatistics linkStatistics;
+        bondStatistics(bond, &linkStatistics);
+        int maxDataSize = linkStatistics.maxPayloadSize - DATA_PACKET_MAX_HEADER_SIZE;
+        int dataSize = INITIAL_DATA_SIZE < maxDataSize ? INITIAL_DATA_SIZE : maxDataSize;
+
+        // A thread produtora lê os ficheiros e constrói os pacotes enquanto esta thread os envia,
+        // pelo que a leitura dos ficheiros não atrasa o envio das tramas
+        PacketRing ring;
+        if (ringInit(&ring, RING_SLOTS, MAX_PAYLOAD_SIZE) < 0) {
+            printf("Erro a alocar os pacotes de dados\n");
+            exit(-1);
+        }
+        atomic_int sharedDataSize = dataSize;
+        args.ring = &ring;
+        args.dataSize = &sharedDataSize;
+        pthread_t producerThread;
+        if (pthread_create(&producerThread, NULL, producer, &args) != 0) {
+            printf("Erro a criar a thread produtora\n");
             exit(-1);
         }
 
-        fclose(file);
+        // Enviar pacotes, com o tamanho dos dados ajustado a cada ADAPT_INTERVAL pacotes
+        int packetsSinceAdapt = 0;
+        while (TRUE) {
+            int packetSize;
+            unsigned char *packet = ringPeek(&ring, &packetSize);
+            if (packetSize < 0) {
+                printf("Erro a ler o ficheiro\n");
+                exit(-1);
+            }
+            if (packetSize == 0) break;  // fim do último ficheiro
+            sendPacket(bond, packet, packetSize);
+            ringRelease(&ring);
+            if (++packetsSinceAdapt == ADAPT_INTERVAL) {
+                dataSize = adaptDataSize(bond, dataSize, maxDataSize, &linkStatistics);
+                atomic_store(&sharedDataSize, dataSize);
+                packetsSinceAdapt = 0;
+            }
+        }
+        pthread_join(producerThread, NULL);
+        ringDestroy(&ring);
+        if (args.fileBytes > 0) {
+            printf("Foram enviados %lld bytes dos ficheiros em %lld bytes de dados (%.1f%%)\n",
+                   args.fileBytes, args.dataBytes, 100.0 * args.dataBytes / args.fileBytes);  // DEBUG
+        }
+
+        for (int i = 0; i < fileCount; i++) free(files[i].path);
+        free(files);
     } else if (connectionParameters.role == LlRx) {
-        FILE *newFile = fopen(filename, "wb");
-        if (newFile == NULL) {
-            printf("Erro a abrir o ficheiro %s para escrever\n", filename);
+        // O ficheiro (ou, num lote, a diretoria) só é criado quando chega o pacote 'start' (ou 'manifest')
+        char checkpointName[strlen(filename) + strlen(BATCH_CHECKPOINT_NAME) + strlen(CHECKPOINT_SUFFIX) + 2];
+
+        PacketRing ring;
+        if (ringInit(&ring, RX_RING_SLOTS, MAX_PAYLOAD_SIZE) < 0) {
+            printf("Erro a alocar os pacotes recebidos\n");
+            exit(-1);
+        }
+        Writer args = {.fd = -1, .ring = &ring, .directory = NULL, .checkpointName = checkpointName, .resumeOffset = 0, .map = NULL, .mapSize = 0};
+        pthread_t writerThread;
+        if (pthread_create(&writerThread, NULL, writer, &args) != 0) {
+            printf("Erro a criar a thread escritora\n");
             exit(-1);
         }
 
-        unsigned char *packet = (unsigned char *)malloc(MAX_DATA_SIZE);
-        while (TRUE) {
-            if (llread(packet) > 0) {
-                if (packet[0] == CONTROL_PACKET_START) {
-                    int fileSize;
-                    char *newFileName = parseControlPacket(packet, &fileSize);
-                    printf("Início da receção do ficheiro %s (%d bytes)\n", newFileName, fileSize);
-                } else if (packet[0] == DATA_PACKET) {
-                    int dataSize = packet[1] * 256 + packet[2];
-                    fwrite(packet + 3, sizeof(unsigned char), dataSize, newFile);
-
-                    printAL("Pacote de Dados Recebido", packet, dataSize + 3);  // DEBUG
-                } else if (packet[0] == CONTROL_PACKET_END) {
-                    int fileSize;
-                    char *newFileName = parseControlPacket(packet, &fileSize);
-                    printf("Fim da receção do ficheiro %s (%d bytes)\n", newFileName, fileSize);
-                    break;
+        // Com várias portas série, as threads das ligações de dados entregam os pacotes de dados à reordenação
+        Reassembler reassembler = {.lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER, .ring = &ring, .started = {FALSE}, .nextOffset = {0}, .packets = NULL};
+        bond = bondOpen(connectionParameters, serialPort, reassemblerDeliver, &reassembler);
+        if (bond == NULL) {
+            printf("Erro a estabelecer a ligação\n");
+            exit(-1);
+        }
+        LinkHandle *control = bondControl(bond);
+        int bonded = bondLinks(bond) > 1;
+
+        // Com uma só porta série, cada pacote é recebido diretamente numa posição livre do anel e passado à thread escritora;
+        // depois do 'start' de um só ficheiro, os dados vão diretamente para o ficheiro mapeado
+        int remainingFiles = 1;  // ficheiros cujo pacote 'end' ainda não chegou
+        Placement placement = {.map = NULL, .mapSize = 0, .nextOffset = 0};
+        unsigned char *received = bonded ? (unsigned char *)malloc(MAX_PAYLOAD_SIZE) : NULL;
+        unsigned char *packet = bonded ? received : ringAcquire(&ring);
+        while (remainingFiles > 0) {
+            int placed = FALSE;
+            int packetSize = placement.map == NULL ? linkRead(control, packet)
+                : linkReadPlaced(control, packet, dataPacketHeaderSize(placement.nextOffset, placement.compressed, 0), placeData, &placement, &placed);
+            if (packetSize < 0 && linkHungUp(control)) {
+                printf("Erro a receber da ligação\n");
+                exit(-1);
+            }
+            if (packetSize <= 0) continue;
+            if (placement.map != NULL && packet[0] == DATA_PACKET) confirmPlacement(&placement, packet, packetSize, placed);
+            if (bonded && packet[0] == DATA_PACKET) {
+                reassemblerDeliver(&reassembler, packet, packetSize);
+                continue;
+            }
+            if (packet[0] == CONTROL_PACKET_MANIFEST && args.directory == NULL && args.fd < 0) {
+                // Procura um checkpoint do mesmo lote e responde com o número de ficheiros que já estão completos
+                long long totalSize;
+                if (parseManifestPacket(packet, packetSize, &args.fileCount, &totalSize, &args.transferId, &args.fingerprint) < 0) continue;
+                if (mkdir(filename, 0777) < 0 && errno != EEXIST) {
+                    printf("Erro a criar a diretoria %s\n", filename);
+                    exit(-1);
+                }
+                printf("Início da receção de um lote de %d ficheiros (%lld bytes)\n", args.fileCount, totalSize);
+                sprintf(checkpointName, "%s/%s", filename, BATCH_CHECKPOINT_NAME);
+                long long filesCompleted = loadCheckpoint(checkpointName, args.transferId, args.fingerprint);
+                if (filesCompleted > args.fileCount) filesCompleted = 0;
+                if (filesCompleted > 0) printf("A retomar o lote a partir do ficheiro %lld\n", filesCompleted + 1);
+                args.filesCompleted = filesCompleted;
+                args.directory = filename;
+                remainingFiles = args.fileCount - args.filesCompleted;
+
+                unsigned char resumePacket[9 + MAX_NUMBER_LENGTH];
+                int resumePacketSize = buildResumePacket(args.transferId, filesCompleted, resumePacket);
+                if (linkWrite(control, resumePacket, resumePacketSize) < 0 || linkFlush(control) < 0) {
+                    printf("Erro a enviar pacote de controlo 'resume'\n");
+                    exit(-1);
                 }
+                continue;
+            }
+            if (packet[0] == CONTROL_PACKET_START && args.directory == NULL) {
+                // Procura um checkpoint da mesma transferência e responde com a posição a partir da qual ela continua
+                long long fileSize;
+                int stream;
+                char *newFileName = parseControlPacket(packet, packetSize, &fileSize, &args.transferId, &args.fingerprint, &stream);
+                free(newFileName);
+                if (args.fd < 0) {
+                    args.fd = open(filename, O_RDWR | O_CREAT, 0666);  // o conteúdo é mantido se a transferência for retomada; O_RDWR para o mapear
+                    if (args.fd < 0) {
+                        printf("Erro a abrir o ficheiro %s para escrever\n", filename);
+                        exit(-1);
+                    }
+                }
+                sprintf(checkpointName, "%s%s", filename, CHECKPOINT_SUFFIX);
+                args.resumeOffset = loadCheckpoint(checkpointName, args.transferId, args.fingerprint);
+                if (args.resumeOffset > fileSize) args.resumeOffset = 0;
+                if (args.resumeOffset == 0) ftruncate(args.fd, 0);  // nova transferência
+                if (args.resumeOffset > 0) printf("A retomar a transferência a partir do byte %lld\n", args.resumeOffset);
+
+                // O ficheiro só é mapeado com o seu tamanho final, que passa a ter desde já; se a transferência terminar antes
+                // do fim, volta à posição do checkpoint
+                if (!bonded && placement.map == NULL && fileSize > 0 && fileSize == (long long)(size_t)fileSize) {
+                    atomic_store(&mappedCommitted, args.resumeOffset);
+                    atomic_store(&mappedFd, args.fd);
+                    atexit(truncateMappedFile);
+                    signal(SIGINT, truncateMappedFileOnSignal);
+                    signal(SIGTERM, truncateMappedFileOnSignal);
+                    void *map = ftruncate(args.fd, fileSize) == 0 ? mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, args.fd, 0) : MAP_FAILED;
+                    if (map != MAP_FAILED) {
+                        placement.map = (unsigned char *)map;
+                        placement.mapSize = fileSize;
+                    } else {
+                        truncateMappedFile();
+                        atomic_store(&mappedFd, -1);
+                    }
+                }
+                placement.nextOffset = args.resumeOffset;
+                args.map = placement.map;
+                args.mapSize = placement.mapSize;
+
+                // Os dados enviados depois da resposta só passam à thread escritora depois do 'start'
+                if (bonded) reassemblerPublish(&reassembler, packet, packetSize, args.resumeOffset);
+                unsigned char resumePacket[9 + MAX_NUMBER_LENGTH];
+                int resumePacketSize = buildResumePacket(args.transferId, args.resumeOffset, resumePacket);
+                if (linkWrite(control, resumePacket, resumePacketSize) < 0 || linkFlush(control) < 0) {
+                    printf("Erro a enviar pacote de controlo 'resume'\n");
+                    exit(-1);
+                }
+                if (bonded) continue;
+            }
+            if (packet[0] == CONTROL_PACKET_END) remainingFiles--;
+            if (bonded) {
+                reassemblerPublish(&reassembler, packet, packetSize, 0);
+                continue;
             }
+            ringPublish(&ring, packetSize);
+            packet = ringAcquire(&ring);
         }
+        // Fim da transferência
+        if (bonded) reassemblerPublish(&reassembler, NULL, 0, 0);
+        else ringPublish(&ring, 0);
 
-        fclose(newFile);
-        free(packet);
+        pthread_join(writerThread, NULL);
+        ringDestroy(&ring);
+        free(received);
+        if (placement.map != NULL) munmap(placement.map, placement.mapSize);
+        truncateMappedFile();  // o ficheiro completo já tem o tamanho final
+        atomic_store(&mappedFd, -1);
+        if (args.directory == NULL) close(args.fd);
     }
 
-    if (llclose(TRUE) < 0) {
+    if (bondClose(bond, TRUE) < 0) {
         printf("Erro a concluir a ligação\n");
         exit(-1);
     }
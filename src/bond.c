@@ -0,0 +1,567 @@
+// Link bonding implementation
+
+#include "bond.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Emissor: cada ligação tem uma thread que tira o pacote de dados seguinte logo que a sua janela tem espaço (linkWrite
+// retorna), pelo que uma ligação duas vezes mais rápida envia o dobro dos pacotes. O recetor guarda os pacotes que chegam
+// antes dos anteriores sem deixar de ler, pelo que é o emissor que limita quantos ficam fora de ordem: nenhuma ligação tira
+// um pacote mais de BOND_REORDER_LIMIT pacotes à frente do mais antigo que ainda pode estar por confirmar; até lá, as
+// ligações confirmam os seus pacotes (a que tem o mais antigo deixa assim de atrasar as outras) e esperam.
+// Uma ligação com mais de BOND_DEGRADED_RATE retransmissões e timeouts por pacote (contadores de linkStatistics, em média)
+// e mais de BOND_DEGRADED_FACTOR vezes os da melhor ligação deixa de receber pacotes durante BOND_PROBE_INTERVAL ms,
+// para que os poucos pacotes que ela consegue enviar não atrasem as outras; depois volta a ser medida.
+// Se uma ligação falhar, os pacotes que ainda podiam estar por confirmar são reenviados pelas outras
+#define BOND_UNACKED 8            // pacotes de uma ligação que podem estar por confirmar (módulo dos números de sequência)
+#define BOND_REORDER_LIMIT 128
+#define BOND_DEGRADED_RATE 0.5
+#define BOND_DEGRADED_FACTOR 4
+#define BOND_PROBE_INTERVAL 1000
+#define BOND_ERROR_WEIGHT 8       // cada pacote entra com peso 1/BOND_ERROR_WEIGHT na média dos erros por pacote
+
+typedef struct {
+    Bond *bond;
+    LinkHandle *link;
+    LinkLayer parameters;    // parâmetros da ligação, com a sua porta série
+    pthread_t thread;
+    int alive;               // FALSE depois de a ligação falhar
+    int busy;                // a thread está a usar a ligação (sem o lock)
+    int finished;            // recetor: a thread recebeu o fim dos dados da ligação
+    double errorRate;        // emissor: retransmissões e timeouts por pacote (média móvel exponencial)
+    int errors;              // emissor: retransmissões e timeouts da ligação na última medição
+    long long gatedSince;    // instante em que a ligação passou a degradada, ou 0
+    unsigned char *history;  // cópias dos últimos BOND_UNACKED pacotes enviados desde a última confirmação de todos
+    int historySizes[BOND_UNACKED];
+    long long historyOrders[BOND_UNACKED];  // ordem de cada pacote do histórico entre os pacotes tirados por todas as ligações
+    int historyHead;         // posição do pacote mais antigo
+    int historyCount;
+    LinkStatistics stats;    // contadores da ligação, copiados pela thread que a usa
+    long long packets;       // pacotes de dados enviados ou recebidos pela ligação
+    long long bytes;
+} BondLink;
+
+struct Bond {
+    BondLink links[MAX_BOND_LINKS];
+    int count;
+    int alive;  // ligações que não falharam
+    LinkLayerRole role;
+    long long closeTimeout;  // ms que o recetor espera pelo fim dos dados de cada ligação em bondClose
+    long long openedAt;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;  // sinalizada sempre que um pacote é tirado ou enviado, ou uma ligação termina ou falha
+    const unsigned char *pending;  // pacote de dados à espera de uma ligação (bondSend)
+    int pendingSize;
+    unsigned char *retry;  // pacotes das ligações que falharam, a reenviar pelas outras (fila circular)
+    int retrySizes[BOND_UNACKED * MAX_BOND_LINKS];
+    int retryHead;
+    int retryCount;
+    long long nextOrder;  // ordem do próximo pacote tirado por uma ligação
+    int flushing;  // bondSendControl espera que todos os pacotes sejam confirmados
+    int closing;
+    BondDeliver deliver;
+    void *context;
+};
+
+// Retorna o instante atual do relógio monotónico, em milissegundos
+long long bondMillis() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Espera (com o lock) por uma alteração do estado do bond ou até ao instante deadline do relógio monotónico
+void bondWaitUntil(Bond *bond, long long deadline) {
+    struct timespec until = {deadline / 1000, (deadline % 1000) * 1000000};
+    pthread_cond_timedwait(&bond->changed, &bond->lock, &until);
+}
+
+// Imprime uma mensagem a partir da thread de uma ligação, com o stdout bloqueado e sem poder ser cancelada a meio (como printLL)
+void printBond(const char *format, ...) {
+    int cancelState;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelState);
+    flockfile(stdout);
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    funlockfile(stdout);
+    pthread_setcancelstate(cancelState, NULL);
+}
+
+// Marca a ligação como falhada e põe os pacotes que ela podia ter por confirmar na fila dos que são reenviados pelas outras
+// O recetor descarta os que afinal tinham chegado, pela sua posição no ficheiro
+void bondFail(Bond *bond, BondLink *self) {
+    printBond("Falhou a ligação na porta %s: %d pacotes reenviados pelas outras\n", self->parameters.serialPort, self->historyCount);
+    self->alive = FALSE;
+    bond->alive--;
+    for (int i = 0; i < self->historyCount; i++) {
+        int from = (self->historyHead + i) % BOND_UNACKED;
+        int to = (bond->retryHead + bond->retryCount) % (BOND_UNACKED * MAX_BOND_LINKS);
+        memcpy(bond->retry + to * MAX_PAYLOAD_SIZE, self->history + from * MAX_PAYLOAD_SIZE, self->historySizes[from]);
+        bond->retrySizes[to] = self->historySizes[from];
+        bond->retryCount++;
+    }
+    self->historyCount = 0;
+    pthread_cond_broadcast(&bond->changed);
+}
+
+// Atualiza (com o lock) os contadores da ligação e a média das retransmissões e timeouts por pacote, depois de um pacote enviado
+// ou confirmado (um timeout também conta como retransmissão, pelo que pesa o dobro de um REJ ou SREJ)
+void bondMeasure(BondLink *self) {
+    linkStatistics(self->link, &self->stats);
+    int errors = self->stats.retransmissions + self->stats.timeouts;
+    self->errorRate += (errors - self->errors - self->errorRate) / BOND_ERROR_WEIGHT;
+    self->errors = errors;
+}
+
+// Verifica se a ligação tem mais de BOND_DEGRADED_RATE retransmissões e timeouts por pacote e mais de BOND_DEGRADED_FACTOR vezes os da melhor
+int bondDegraded(Bond *bond, BondLink *self) {
+    if (self->errorRate <= BOND_DEGRADED_RATE) return FALSE;
+    double best = self->errorRate;
+    for (int i = 0; i < bond->count; i++) {
+        BondLink *other = &bond->links[i];
+        if (other->alive && other->errorRate < best) best = other->errorRate;
+    }
+    return self->errorRate > BOND_DEGRADED_FACTOR * best;
+}
+
+// Verifica (com o lock) se o próximo pacote ficaria mais de BOND_REORDER_LIMIT pacotes à frente do mais antigo dos históricos,
+// que pode ainda não ter chegado ao recetor
+int bondTooFarAhead(Bond *bond) {
+    for (int i = 0; i < bond->count; i++) {
+        BondLink *other = &bond->links[i];
+        if (other->alive && other->historyCount > 0 && bond->nextOrder - other->historyOrders[other->historyHead] >= BOND_REORDER_LIMIT) return TRUE;
+    }
+    return FALSE;
+}
+
+// Confirma (sem o lock) todos os pacotes enviados pela ligação
+// Retorna 1 em caso de sucesso, -1 se a ligação falhou
+int bondFlush(Bond *bond, BondLink *self) {
+    self->busy = TRUE;
+    pthread_mutex_unlock(&bond->lock);
+    int result = linkFlush(self->link);
+    pthread_mutex_lock(&bond->lock);
+    self->busy = FALSE;
+    if (result < 0) {
+        bondFail(bond, self);
+        return -1;
+    }
+    bondMeasure(self);
+    self->historyCount = 0;
+    pthread_cond_broadcast(&bond->changed);
+    return 1;
+}
+
+/**
+ * Thread de cada ligação do emissor: envia os pacotes de dados que tira da fila dos reenvios ou de bondSend
+ * @param arg ligação (BondLink)
+ * @return NULL
+ *
+ * @details
+ * Cada pacote é copiado para o histórico da ligação antes de ser enviado, pelo que pode ser reenviado por outra ligação
+ * se esta falhar. Quando bondSendControl espera que todos os pacotes sejam confirmados, a ligação chama linkFlush; o mesmo
+ * acontece quando a ligação passa a degradada, para que os seus pacotes cheguem ao recetor, e quando o próximo pacote
+ * ficaria demasiado à frente do mais antigo por confirmar (bondTooFarAhead). No fim, as ligações de dados enviam uma
+ * trama I vazia, que termina a thread correspondente do recetor
+ */
+void *bondSender(void *arg) {
+    BondLink *self = (BondLink *)arg;
+    Bond *bond = self->bond;
+    pthread_mutex_lock(&bond->lock);
+    while (TRUE) {
+        int work = bond->retryCount > 0 || bond->pending != NULL;
+        if (!work) {
+            if (bond->flushing && self->historyCount > 0) {
+                if (bondFlush(bond, self) < 0) break;
+                continue;
+            }
+            if (bond->closing) break;
+            pthread_cond_wait(&bond->changed, &bond->lock);
+            continue;
+        }
+
+        if (bondDegraded(bond, self)) {
+            long long now = bondMillis();
+            if (self->gatedSince == 0) {
+                printBond("Ligação na porta %s degradada: %.2f retransmissões e timeouts por pacote\n", self->parameters.serialPort, self->errorRate);  // DEBUG
+                self->gatedSince = now;
+            }
+            if (self->historyCount > 0) {
+                if (bondFlush(bond, self) < 0) break;
+                continue;
+            }
+            if (now - self->gatedSince < BOND_PROBE_INTERVAL) {
+                bondWaitUntil(bond, self->gatedSince + BOND_PROBE_INTERVAL);
+                continue;
+            }
+            // Volta a receber pacotes e a ser medida
+            self->errorRate = 0;
+            self->gatedSince = 0;
+        }
+
+        if (bondTooFarAhead(bond)) {
+            // O recetor ainda espera por um pacote antigo: a ligação confirma os seus pacotes (pode ser ela a atrasada) e espera
+            if (self->historyCount > 0) {
+                if (bondFlush(bond, self) < 0) break;
+                continue;
+            }
+            pthread_cond_wait(&bond->changed, &bond->lock);
+            continue;
+        }
+
+        // Copia o pacote para o histórico (o mais antigo é substituído, porque já foi confirmado)
+        if (self->historyCount == BOND_UNACKED) {
+            self->historyHead = (self->historyHead + 1) % BOND_UNACKED;
+            self->historyCount--;
+        }
+        int slot = (self->historyHead + self->historyCount) % BOND_UNACKED;
+        unsigned char *packet = self->history + slot * MAX_PAYLOAD_SIZE;
+        if (bond->retryCount > 0) {
+            self->historySizes[slot] = bond->retrySizes[bond->retryHead];
+            memcpy(packet, bond->retry + bond->retryHead * MAX_PAYLOAD_SIZE, self->historySizes[slot]);
+            bond->retryHead = (bond->retryHead + 1) % (BOND_UNACKED * MAX_BOND_LINKS);
+            bond->retryCount--;
+        } else {
+            self->historySizes[slot] = bond->pendingSize;
+            memcpy(packet, bond->pending, bond->pendingSize);
+            bond->pending = NULL;
+        }
+        self->historyOrders[slot] = bond->nextOrder++;
+        self->historyCount++;
+        pthread_cond_broadcast(&bond->changed);
+
+        self->busy = TRUE;
+        pthread_mutex_unlock(&bond->lock);
+        int result = linkWrite(self->link, packet, self->historySizes[slot]);
+        pthread_mutex_lock(&bond->lock);
+        self->busy = FALSE;
+        if (result < 0) {
+            bondFail(bond, self);
+            break;
+        }
+        bondMeasure(self);
+        self->packets++;
+        self->bytes += self->historySizes[slot];
+        pthread_cond_broadcast(&bond->changed);
+    }
+    int marker = self->alive && self != &bond->links[0];
+    pthread_mutex_unlock(&bond->lock);
+
+    if (marker) {
+        unsigned char end;
+        linkWrite(self->link, &end, 0);
+    }
+    return NULL;
+}
+
+// Liberta o buffer de uma thread do recetor terminada com pthread_cancel
+void bondFreeBuffer(void *buffer) {
+    free(buffer);
+}
+
+/**
+ * Thread de cada ligação de dados do recetor: passa a deliver os pacotes recebidos, até à trama I vazia
+ * @param arg ligação (BondLink)
+ * @return NULL
+ *
+ * @details
+ * A thread só pode ser cancelada dentro de linkRead, pelo que bondClose a pode terminar se a trama vazia não chegar
+ * (por exemplo, porque a ligação falhou no emissor) sem a interromper a meio de deliver. Se a porta série deixar de estar
+ * ligada, a thread termina e a ligação fica marcada como falhada: os seus pacotes são reenviados pelas outras
+ */
+void *bondReader(void *arg) {
+    BondLink *self = (BondLink *)arg;
+    Bond *bond = self->bond;
+    unsigned char *packet = (unsigned char *)malloc(MAX_PAYLOAD_SIZE);
+    pthread_cleanup_push(bondFreeBuffer, packet);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    while (TRUE) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        int packetSize = linkRead(self->link, packet);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (packetSize == 0) break;  // fim dos dados desta ligação
+        if (packetSize < 0 && linkHungUp(self->link)) break;
+        if (packetSize < 0) continue;
+        self->packets++;
+        self->bytes += packetSize;
+        bond->deliver(bond->context, packet, packetSize);
+    }
+    pthread_cleanup_pop(TRUE);
+
+    pthread_mutex_lock(&bond->lock);
+    if (linkHungUp(self->link)) {
+        self->alive = FALSE;
+        bond->alive--;
+    } else {
+        self->finished = TRUE;
+    }
+    pthread_cond_broadcast(&bond->changed);
+    pthread_mutex_unlock(&bond->lock);
+    return NULL;
+}
+
+// Thread que estabelece uma ligação
+void *bondOpener(void *arg) {
+    BondLink *self = (BondLink *)arg;
+    self->link = linkOpen(self->parameters);
+    return NULL;
+}
+
+// Liberta o bond, depois de fechadas as ligações
+void bondFree(Bond *bond) {
+    for (int i = 0; i < bond->count; i++) free(bond->links[i].history);
+    free(bond->retry);
+    pthread_mutex_destroy(&bond->lock);
+    pthread_cond_destroy(&bond->changed);
+    free(bond);
+}
+
+/**
+ * Abre uma ligação em cada porta série da lista
+ * @param connectionParameters parâmetros de todas as ligações (a porta série é ignorada)
+ * @param ports portas série separadas por vírgulas
+ * @param deliver recetor: função chamada com os pacotes das ligações de dados
+ * @param context argumento passado a deliver
+ * @return bond, ou NULL em caso de erro
+ *
+ * @details
+ * As ligações são estabelecidas ao mesmo tempo, cada uma na sua thread: estabelecidas uma de cada vez, o recetor já
+ * estaria à espera do SET da ligação seguinte quando o emissor repetisse o SET de uma ligação cujo UA se perdeu.
+ * A lista tem de ter a mesma ordem nos dois lados. Com uma só porta não são criadas threads: bondSend e bondSendControl
+ * usam a ligação diretamente
+ */
+Bond *bondOpen(LinkLayer connectionParameters, const char *ports, BondDeliver deliver, void *context) {
+    Bond *bond = (Bond *)calloc(1, sizeof(Bond));
+    if (bond == NULL) return NULL;
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);  // para bondWaitUntil
+    pthread_cond_init(&bond->changed, &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_mutex_init(&bond->lock, NULL);
+    bond->role = connectionParameters.role;
+    bond->closeTimeout = (long long)(connectionParameters.nRetransmissions + 1) * connectionParameters.timeout * 1000;
+    bond->deliver = deliver;
+    bond->context = context;
+
+    const char *port = ports;
+    while (TRUE) {
+        const char *comma = strchr(port, ',');
+        int length = comma != NULL ? comma - port : (int)strlen(port);
+        if (bond->count == MAX_BOND_LINKS || length == 0 || length >= (int)sizeof(connectionParameters.serialPort)) {
+            printf("Lista de portas série inválida: %s\n", ports);
+            bondFree(bond);
+            return NULL;
+        }
+        BondLink *self = &bond->links[bond->count++];
+        self->parameters = connectionParameters;
+        memcpy(self->parameters.serialPort, port, length);
+        self->parameters.serialPort[length] = '\0';
+        if (comma == NULL) break;
+        port = comma + 1;
+    }
+
+    if (bond->count == 1) {
+        bondOpener(&bond->links[0]);
+    } else {
+        for (int i = 0; i < bond->count; i++) {
+            if (pthread_create(&bond->links[i].thread, NULL, bondOpener, &bond->links[i]) != 0) bond->links[i].thread = 0;
+        }
+        for (int i = 0; i < bond->count; i++) {
+            if (bond->links[i].thread != 0) pthread_join(bond->links[i].thread, NULL);
+        }
+    }
+    for (int i = 0; i < bond->count; i++) {
+        BondLink *self = &bond->links[i];
+        if (self->link == NULL) {
+            printf("Erro a estabelecer a ligação na porta %s\n", self->parameters.serialPort);
+            for (int j = 0; j < bond->count; j++) {
+                if (bond->links[j].link != NULL) linkClose(bond->links[j].link, FALSE);
+            }
+            bondFree(bond);
+            return NULL;
+        }
+        self->bond = bond;
+        self->alive = TRUE;
+        linkStatistics(self->link, &self->stats);
+        self->errors = self->stats.retransmissions + self->stats.timeouts;
+        bond->alive++;
+    }
+    bond->openedAt = bondMillis();
+    if (bond->count == 1) return bond;
+
+    if (bond->role == LlTx) {
+        bond->retry = (unsigned char *)malloc(BOND_UNACKED * MAX_BOND_LINKS * MAX_PAYLOAD_SIZE);
+        for (int i = 0; i < bond->count; i++) {
+            bond->links[i].history = (unsigned char *)malloc(BOND_UNACKED * MAX_PAYLOAD_SIZE);
+            // O histórico só guarda BOND_UNACKED pacotes, pelo que cada pacote tem de ir na sua trama I
+            linkSetAggregation(bond->links[i].link, FALSE);
+        }
+    }
+    for (int i = bond->role == LlTx ? 0 : 1; i < bond->count; i++) {
+        BondLink *self = &bond->links[i];
+        if (pthread_create(&self->thread, NULL, bond->role == LlTx ? bondSender : bondReader, self) != 0) {
+            printf("Erro a criar a thread da ligação na porta %s\n", self->parameters.serialPort);
+            exit(-1);
+        }
+    }
+    return bond;
+}
+
+int bondLinks(Bond *bond) {
+    return bond->count;
+}
+
+LinkHandle *bondControl(Bond *bond) {
+    return bond->links[0].link;
+}
+
+int bondSend(Bond *bond, const unsigned char *packet, int packetSize) {
+    if (bond->count == 1) {
+        bond->links[0].packets++;
+        bond->links[0].bytes += packetSize;
+        return linkWrite(bond->links[0].link, packet, packetSize) < 0 ? -1 : 1;
+    }
+
+    pthread_mutex_lock(&bond->lock);
+    while (bond->pending != NULL && bond->alive > 0) pthread_cond_wait(&bond->changed, &bond->lock);
+    bond->pending = packet;
+    bond->pendingSize = packetSize;
+    pthread_cond_broadcast(&bond->changed);
+    while (bond->pending == packet && bond->alive > 0) pthread_cond_wait(&bond->changed, &bond->lock);
+    int result = bond->pending == packet ? -1 : 1;  // todas as ligações falharam antes de o pacote ser tirado
+    bond->pending = NULL;
+    pthread_mutex_unlock(&bond->lock);
+    return result;
+}
+
+// Verifica (com o lock) se todos os pacotes de dados foram enviados e confirmados
+int bondDrained(Bond *bond) {
+    if (bond->pending != NULL || bond->retryCount > 0) return FALSE;
+    for (int i = 0; i < bond->count; i++) {
+        BondLink *self = &bond->links[i];
+        if (self->alive && (self->busy || self->historyCount > 0)) return FALSE;
+    }
+    return TRUE;
+}
+
+int bondSendControl(Bond *bond, const unsigned char *packet, int packetSize) {
+    if (bond->count == 1) return linkWrite(bond->links[0].link, packet, packetSize) < 0 ? -1 : 1;
+
+    // Com todas as threads paradas, a ligação de controlo é usada diretamente por esta thread
+    pthread_mutex_lock(&bond->lock);
+    bond->flushing = TRUE;
+    pthread_cond_broadcast(&bond->changed);
+    while (bond->alive > 0 && !bondDrained(bond)) pthread_cond_wait(&bond->changed, &bond->lock);
+    bond->flushing = FALSE;
+    int result = bond->alive > 0 && bond->links[0].alive ? 1 : -1;
+    pthread_mutex_unlock(&bond->lock);
+    if (result < 0) return -1;
+
+    if (linkWrite(bond->links[0].link, packet, packetSize) < 0 || linkFlush(bond->links[0].link) < 0) return -1;
+    return 1;
+}
+
+void bondStatistics(Bond *bond, LinkStatistics *stats) {
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&bond->lock);
+    for (int i = 0; i < bond->count; i++) {
+        BondLink *self = &bond->links[i];
+        if (!self->busy) linkStatistics(self->link, &self->stats);  // a ligação não está a ser usada por outra thread
+        if (i == 0 || self->stats.maxPayloadSize < stats->maxPayloadSize) stats->maxPayloadSize = self->stats.maxPayloadSize;
+        stats->framesSent += self->stats.framesSent;
+        stats->retransmissions += self->stats.retransmissions;
+        stats->timeouts += self->stats.timeouts;
+        stats->rejectsReceived += self->stats.rejectsReceived;
+        stats->fcsErrors += self->stats.fcsErrors;
+    }
+    pthread_mutex_unlock(&bond->lock);
+}
+
+// Fecha uma ligação, com as estatísticas e a parte dos dados que ela enviou ou recebeu
+// Retorna o resultado de linkClose
+int bondCloseLink(Bond *bond, BondLink *self, int showStatistics) {
+    if (showStatistics && bond->count > 1) {
+        printf("\nLigação na porta %s", self->parameters.serialPort);
+        if (bond->role == LlTx || self != &bond->links[0]) {
+            double seconds = (bondMillis() - bond->openedAt) / 1000.0;
+            printf(": %lld pacotes de dados, %lld bytes (%.0f bytes/s)", self->packets, self->bytes, seconds > 0 ? self->bytes / seconds : 0);
+        }
+        printf("\n");
+    }
+    int result = linkClose(self->link, showStatistics);
+    self->link = NULL;
+    if (result < 0 && self != &bond->links[0]) printf("Erro a concluir a ligação na porta %s\n", self->parameters.serialPort);
+    return result;
+}
+
+/**
+ * Termina as threads e fecha as ligações, primeiro a de controlo e depois as de dados, pela ordem da lista
+ * @param bond bond
+ * @param showStatistics TRUE para imprimir as estatísticas de cada ligação e a parte dos dados que ela enviou ou recebeu
+ * @return 1 em caso de sucesso, -1 se não foi possível fechar a ligação de controlo
+ *
+ * @details
+ * O emissor envia a trama I vazia em cada ligação de dados antes de fechar a de controlo, pelo que, quando o recetor
+ * acaba de a fechar, as threads das ligações de dados que não falharam já terminaram: são fechadas pela mesma ordem
+ * que no emissor. O recetor espera até closeTimeout ms pelas restantes que ainda estão ligadas; as que não terminam
+ * (a ligação falhou no emissor) são canceladas e as ligações que falharam são fechadas com linkAbort, sem a troca de DISC.
+ * Um erro a fechar uma ligação de dados é apenas indicado, porque os dados já foram todos recebidos
+ */
+int bondClose(Bond *bond, int showStatistics) {
+    if (bond->count > 1 && bond->role == LlTx) {
+        pthread_mutex_lock(&bond->lock);
+        bond->closing = TRUE;
+        pthread_cond_broadcast(&bond->changed);
+        pthread_mutex_unlock(&bond->lock);
+        for (int i = 0; i < bond->count; i++) pthread_join(bond->links[i].thread, NULL);
+    }
+
+    int result = bondCloseLink(bond, &bond->links[0], showStatistics) < 0 ? -1 : 1;
+    for (int i = 1; i < bond->count; i++) {
+        BondLink *self = &bond->links[i];
+        pthread_mutex_lock(&bond->lock);
+        int finished = bond->role == LlTx ? self->alive : self->finished;
+        pthread_mutex_unlock(&bond->lock);
+        if (!finished) continue;
+        if (bond->role == LlRx) pthread_join(self->thread, NULL);
+        bondCloseLink(bond, self, showStatistics);
+    }
+
+    if (bond->count > 1 && bond->role == LlRx) {
+        pthread_mutex_lock(&bond->lock);
+        long long deadline = bondMillis() + bond->closeTimeout;
+        for (int i = 1; i < bond->count; i++) {
+            while (!bond->links[i].finished && bond->links[i].alive && bondMillis() < deadline) bondWaitUntil(bond, deadline);
+        }
+        pthread_mutex_unlock(&bond->lock);
+        for (int i = 1; i < bond->count; i++) {
+            BondLink *self = &bond->links[i];
+            if (self->link == NULL) continue;
+            if (!self->finished) {
+                if (self->alive) {
+                    printf("A ligação na porta %s não terminou os dados\n", self->parameters.serialPort);
+                    pthread_cancel(self->thread);
+                }
+                pthread_join(self->thread, NULL);
+                linkAbort(self->link);
+                self->link = NULL;
+            } else {
+                pthread_join(self->thread, NULL);
+                bondCloseLink(bond, self, showStatistics);
+            }
+        }
+    }
+    for (int i = 0; i < bond->count; i++) {
+        if (bond->links[i].link != NULL) linkAbort(bond->links[i].link);  // emissor: ligações que falharam
+    }
+    bondFree(bond);
+    return result;
+}
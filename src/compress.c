@@ -0,0 +1,133 @@
+// Compression implementation
+
+#include "compress.h"
+
+#include <string.h>
+
+// Cada sequência tem um token (4 bits com o número de literais e 4 bits com o comprimento da repetição - MIN_MATCH),
+// os bytes de extensão dos comprimentos que não cabem no token, os literais e a distância da repetição (2 bytes, LSB primeiro).
+// A última sequência só tem literais
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define RUN_MASK 15  // valor do campo do token que indica que o comprimento continua nos bytes de extensão
+#define HASH_BITS 12
+
+// Lê 4 bytes de p (sem exigir alinhamento)
+unsigned int lzRead32(const unsigned char *p) {
+    unsigned int value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Posição da tabela de dispersão dos 4 bytes em p
+unsigned int lzHash(const unsigned char *p) {
+    return (lzRead32(p) * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// Retorna o número de bytes de extensão de um comprimento n
+int lzLengthBytes(int n) {
+    return n < RUN_MASK ? 0 : (n - RUN_MASK) / 255 + 1;
+}
+
+// Escreve em dst os bytes de extensão de um comprimento n
+// Retorna o número de bytes escritos
+int lzWriteLength(unsigned char *dst, int n) {
+    if (n < RUN_MASK) return 0;
+    int index = 0;
+    for (n -= RUN_MASK; n >= 255; n -= 255) dst[index++] = 255;
+    dst[index++] = n;
+    return index;
+}
+
+// Lê de src os bytes de extensão de um comprimento cujo campo no token é n
+// Retorna o comprimento, ou -1 se o bloco terminar antes dele
+int lzReadLength(const unsigned char *src, int srcSize, int *index, int n) {
+    if (n < RUN_MASK) return n;
+    unsigned char byte;
+    do {
+        if (*index >= srcSize) return -1;
+        byte = src[(*index)++];
+        n += byte;
+    } while (byte == 255);
+    return n;
+}
+
+int lzCompress(const unsigned char *src, int srcSize, unsigned char *dst, int dstCapacity, int *consumed) {
+    int table[1 << HASH_BITS];  // última posição com cada valor de dispersão
+    memset(table, -1, sizeof(table));
+
+    int anchor = 0;  // início dos literais da sequência atual
+    int ip = 0;
+    int op = 0;
+    while (ip + MIN_MATCH <= srcSize) {
+        int literals = ip - anchor;
+        if (1 + lzLengthBytes(literals) + literals > dstCapacity - op) break;  // os literais já não cabem no bloco
+
+        unsigned int hash = lzHash(src + ip);
+        int candidate = table[hash];
+        table[hash] = ip;
+        if (candidate < 0 || ip - candidate > MAX_OFFSET || lzRead32(src + candidate) != lzRead32(src + ip)) {
+            ip++;
+            continue;
+        }
+
+        int matchLength = MIN_MATCH;
+        while (ip + matchLength < srcSize && src[candidate + matchLength] == src[ip + matchLength]) matchLength++;
+        int room = dstCapacity - op - (1 + lzLengthBytes(literals) + literals + 2);  // bytes livres para a extensão
+        if (room < 0) break;
+        if (lzLengthBytes(matchLength - MIN_MATCH) > room) matchLength = MIN_MATCH + RUN_MASK - 1 + 255 * room;  // encurtada para caber
+
+        // Sequência com os literais desde anchor e a repetição encontrada
+        dst[op++] = (literals < RUN_MASK ? literals : RUN_MASK) << 4 | (matchLength - MIN_MATCH < RUN_MASK ? matchLength - MIN_MATCH : RUN_MASK);
+        op += lzWriteLength(dst + op, literals);
+        memcpy(dst + op, src + anchor, literals);
+        op += literals;
+        dst[op++] = (ip - candidate) & 0xFF;
+        dst[op++] = (ip - candidate) >> 8;
+        op += lzWriteLength(dst + op, matchLength - MIN_MATCH);
+        ip += matchLength;
+        anchor = ip;
+    }
+
+    // Última sequência, com tantos literais quantos couberem no bloco
+    int literals = srcSize - anchor;
+    if (literals > dstCapacity - op - 1) literals = dstCapacity - op - 1;
+    while (literals > 0 && 1 + lzLengthBytes(literals) + literals > dstCapacity - op) literals--;
+    if (literals > 0) {
+        dst[op++] = (literals < RUN_MASK ? literals : RUN_MASK) << 4;
+        op += lzWriteLength(dst + op, literals);
+        memcpy(dst + op, src + anchor, literals);
+        op += literals;
+        anchor += literals;
+    }
+
+    *consumed = anchor;
+    return op;
+}
+
+int lzDecompress(const unsigned char *src, int srcSize, unsigned char *dst, int dstCapacity) {
+    int ip = 0;
+    int op = 0;
+    while (ip < srcSize) {
+        unsigned char token = src[ip++];
+
+        int literals = lzReadLength(src, srcSize, &ip, token >> 4);
+        if (literals < 0 || literals > srcSize - ip || literals > dstCapacity - op) return -1;
+        memcpy(dst + op, src + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == srcSize) break;  // última sequência
+
+        if (srcSize - ip < 2) return -1;
+        int offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        int matchLength = lzReadLength(src, srcSize, &ip, token & RUN_MASK);
+        if (offset == 0 || offset > op || matchLength < 0 || matchLength + MIN_MATCH > dstCapacity - op) return -1;
+        matchLength += MIN_MATCH;
+
+        // A repetição pode sobrepor-se aos bytes que está a produzir, pelo que é copiada byte a byte
+        for (int i = 0; i < matchLength; i++) dst[op + i] = dst[op - offset + i];
+        op += matchLength;
+    }
+    return op;
+}
@@ -0,0 +1,166 @@
+// CRC implementation
+
+#include "crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_CLMUL 1
+#endif
+
+#define CRC16_POLY 0x8408      // 0x1021 refletido
+#define CRC32_POLY 0xEDB88320  // 0x04C11DB7 refletido
+
+// Tabelas slice-by-8: crcXXTable[0] é a tabela byte a byte e crcXXTable[k] corresponde a avançar k bytes de zeros
+unsigned short crc16Table[8][256];
+unsigned int crc32Table[8][256];
+
+#ifdef CRC_CLMUL
+int clmulAvailable = 0;
+#endif
+
+void crcInit() {
+    for (int b = 0; b < 256; b++) {
+        unsigned short c16 = b;
+        unsigned int c32 = b;
+        for (int bit = 0; bit < 8; bit++) {
+            c16 = (c16 & 1) ? (c16 >> 1) ^ CRC16_POLY : c16 >> 1;
+            c32 = (c32 & 1) ? (c32 >> 1) ^ CRC32_POLY : c32 >> 1;
+        }
+        crc16Table[0][b] = c16;
+        crc32Table[0][b] = c32;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int b = 0; b < 256; b++) {
+            crc16Table[k][b] = (crc16Table[k - 1][b] >> 8) ^ crc16Table[0][crc16Table[k - 1][b] & 0xFF];
+            crc32Table[k][b] = (crc32Table[k - 1][b] >> 8) ^ crc32Table[0][crc32Table[k - 1][b] & 0xFF];
+        }
+    }
+#ifdef CRC_CLMUL
+    __builtin_cpu_init();
+    clmulAvailable = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+// Atualiza o CRC-16 (sem inversão inicial/final) com os dados, 8 bytes de cada vez
+unsigned short crc16Update(unsigned short crc, const unsigned char *data, int size) {
+    while (size >= 8) {
+        crc ^= data[0] | (data[1] << 8);
+        crc = crc16Table[7][crc & 0xFF] ^ crc16Table[6][crc >> 8] ^
+              crc16Table[5][data[2]] ^ crc16Table[4][data[3]] ^
+              crc16Table[3][data[4]] ^ crc16Table[2][data[5]] ^
+              crc16Table[1][data[6]] ^ crc16Table[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while (size-- > 0) crc = (crc >> 8) ^ crc16Table[0][(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+// Atualiza o CRC-32 (sem inversão inicial/final) com os dados, 8 bytes de cada vez
+unsigned int crc32UpdateSlice8(unsigned int crc, const unsigned char *data, int size) {
+    while (size >= 8) {
+        crc ^= data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned int)data[3] << 24);
+        crc = crc32Table[7][crc & 0xFF] ^ crc32Table[6][(crc >> 8) & 0xFF] ^
+              crc32Table[5][(crc >> 16) & 0xFF] ^ crc32Table[4][crc >> 24] ^
+              crc32Table[3][data[4]] ^ crc32Table[2][data[5]] ^
+              crc32Table[1][data[6]] ^ crc32Table[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while (size-- > 0) crc = (crc >> 8) ^ crc32Table[0][(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+#ifdef CRC_CLMUL
+/**
+ * Atualiza o CRC-32 (sem inversão inicial/final) com multiplicação sem transporte (PCLMULQDQ)
+ * @param size número de bytes, múltiplo de 16 e maior ou igual a 64
+ *
+ * @details
+ * Dobra 4 blocos de 128 bits de cada vez, depois reduz a um bloco de 128 bits e termina com uma redução de Barrett,
+ * como descrito em "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009)
+ */
+__attribute__((target("pclmul,sse4.1"))) unsigned int crc32UpdateClmul(unsigned int crc, const unsigned char *data, int size) {
+    const __m128i k1k2 = _mm_set_epi64x(0x1c6e41596, 0x154442bd4);  // dobra de 512 bits
+    const __m128i k3k4 = _mm_set_epi64x(0x0ccaa009e, 0x1751997d0);  // dobra de 128 bits
+    const __m128i k5 = _mm_set_epi64x(0, 0x163cd6124);              // dobra final de 64 para 32 bits
+    const __m128i poly = _mm_set_epi64x(0x1f7011641, 0x1db710641);  // mu e polinómio para a redução de Barrett
+    const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(data + 0));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(data + 16));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(data + 32));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(data + 48));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    data += 64;
+    size -= 64;
+
+    while (size >= 64) {
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x00), _mm_clmulepi64_si128(x1, k1k2, 0x11)), _mm_loadu_si128((const __m128i *)(data + 0)));
+        x2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x00), _mm_clmulepi64_si128(x2, k1k2, 0x11)), _mm_loadu_si128((const __m128i *)(data + 16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x00), _mm_clmulepi64_si128(x3, k1k2, 0x11)), _mm_loadu_si128((const __m128i *)(data + 32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x00), _mm_clmulepi64_si128(x4, k1k2, 0x11)), _mm_loadu_si128((const __m128i *)(data + 48)));
+        data += 64;
+        size -= 64;
+    }
+
+    // Redução de 4 blocos para 1
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x2);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x3);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x4);
+
+    // Restantes blocos de 16 bytes
+    while (size >= 16) {
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), _mm_loadu_si128((const __m128i *)data));
+        data += 16;
+        size -= 16;
+    }
+
+    // Dobra de 128 para 64 bits (acrescenta 32 bits a zero)
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(k3k4, x1, 0x01), _mm_srli_si128(x1, 8));
+
+    // Dobra final de 64 para 32 bits
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00), x2);
+
+    // Redução de Barrett de 64 para 32 bits
+    x2 = x1;
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return _mm_extract_epi32(x1, 1);
+}
+#endif
+
+unsigned short crc16(const unsigned char *data, int size) {
+    return crc16Update(0xFFFF, data, size) ^ 0xFFFF;
+}
+
+unsigned int crc32Slice8(const unsigned char *data, int size) {
+    return crc32UpdateSlice8(0xFFFFFFFF, data, size) ^ 0xFFFFFFFF;
+}
+
+unsigned int crc32Update(unsigned int crc, const unsigned char *data, int size) {
+#ifdef CRC_CLMUL
+    if (clmulAvailable && size >= 64) {
+        // Os blocos de 16 bytes são processados com PCLMULQDQ e o resto com as tabelas
+        int blocks = size & ~15;
+        crc = crc32UpdateClmul(crc, data, blocks);
+        data += blocks;
+        size -= blocks;
+    }
+#endif
+    return crc32UpdateSlice8(crc, data, size);
+}
+
+unsigned int crc32(const unsigned char *data, int size) {
+    return crc32Update(0xFFFFFFFF, data, size) ^ 0xFFFFFFFF;
+}
+
+int crc32HasClmul() {
+#ifdef CRC_CLMUL
+    return clmulAvailable;
+#else
+    return 0;
+#endif
+}
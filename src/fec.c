@@ -0,0 +1,157 @@
+// Forward error correction implementation
+
+#include "fec.h"
+
+#include <string.h>
+
+#define GF_POLY 0x11D  // x^8 + x^4 + x^3 + x^2 + 1
+
+// Tabelas de exponenciais e logaritmos de GF(2^8) (gfExp tem o dobro do tamanho para evitar o módulo 255)
+unsigned char gfExp[2 * FEC_BLOCK_SIZE];
+unsigned char gfLog[256];
+
+// Polinómios geradores para cada número de bytes de paridade, do termo de maior grau para o de menor grau
+// São todos calculados em fecInit, pelo que depois só são lidos (várias ligações podem codificar ao mesmo tempo)
+unsigned char generators[FEC_BLOCK_SIZE][FEC_BLOCK_SIZE + 1];
+
+unsigned char gfMul(unsigned char a, unsigned char b) {
+    if (a == 0 || b == 0) return 0;
+    return gfExp[gfLog[a] + gfLog[b]];
+}
+
+unsigned char gfDiv(unsigned char a, unsigned char b) {
+    if (a == 0) return 0;
+    return gfExp[gfLog[a] + FEC_BLOCK_SIZE - gfLog[b]];
+}
+
+// alpha^(-power)
+unsigned char gfInversePower(int power) {
+    return gfExp[(FEC_BLOCK_SIZE - power % FEC_BLOCK_SIZE) % FEC_BLOCK_SIZE];
+}
+
+// Calcula os polinómios geradores (x - alpha^0)(x - alpha^1)...(x - alpha^(nsym-1)), cada um a partir do anterior
+void buildGenerators() {
+    generators[0][0] = 1;
+    for (int nsym = 1; nsym < FEC_BLOCK_SIZE; nsym++) {
+        // Multiplica o gerador anterior por (x + alpha^(nsym-1))
+        unsigned char *generator = generators[nsym];
+        memcpy(generator, generators[nsym - 1], nsym);
+        generator[nsym] = 0;
+        for (int j = nsym; j > 0; j--) generator[j] ^= gfMul(generator[j - 1], gfExp[nsym - 1]);
+    }
+}
+
+void fecInit() {
+    int x = 1;
+    for (int i = 0; i < FEC_BLOCK_SIZE; i++) {
+        gfExp[i] = x;
+        gfExp[i + FEC_BLOCK_SIZE] = x;
+        gfLog[x] = i;
+        x <<= 1;
+        if (x & 0x100) x ^= GF_POLY;
+    }
+    buildGenerators();
+}
+
+void rsEncodeUpdate(unsigned char *parity, int nsym, const unsigned char *data, int size) {
+    const unsigned char *generator = generators[nsym];
+    for (int i = 0; i < size; i++) {
+        // Divisão polinomial por g(x), um byte de cada vez (LFSR)
+        unsigned char feedback = data[i] ^ parity[0];
+        for (int j = 0; j < nsym - 1; j++) parity[j] = parity[j + 1] ^ gfMul(feedback, generator[j + 1]);
+        parity[nsym - 1] = gfMul(feedback, generator[nsym]);
+    }
+}
+
+// Avalia em x o polinómio de 'size' coeficientes, do termo de menor grau para o de maior grau
+unsigned char evaluate(const unsigned char *poly, int size, unsigned char x) {
+    unsigned char y = 0;
+    for (int i = size - 1; i >= 0; i--) y = gfMul(y, x) ^ poly[i];
+    return y;
+}
+
+/**
+ * Corrige uma palavra de código Reed-Solomon
+ * @param codeword mensagem seguida dos bytes de paridade; o byte j é o coeficiente de x^(size-1-j)
+ * @param size número de bytes da palavra de código
+ * @param nsym número de bytes de paridade
+ * @return número de bytes corrigidos, ou -1 se os erros não puderem ser corrigidos
+ *
+ * @details
+ * Síndromes S_i = c(alpha^i); polinómio localizador de erros com Berlekamp-Massey; posições dos erros com a pesquisa de
+ * Chien; valores dos erros com o algoritmo de Forney
+ */
+int rsDecode(unsigned char *codeword, int size, int nsym) {
+    unsigned char syndromes[FEC_BLOCK_SIZE];
+    int errors = 0;
+    for (int i = 0; i < nsym; i++) {
+        unsigned char s = 0;
+        for (int j = 0; j < size; j++) s = gfMul(s, gfExp[i]) ^ codeword[j];
+        syndromes[i] = s;
+        errors |= s != 0;
+    }
+    if (!errors) return 0;
+
+    // Berlekamp-Massey: locator(x) = 1 + L_1 x + ... com raízes nos inversos das posições dos erros
+    unsigned char locator[FEC_BLOCK_SIZE + 1] = {1};
+    unsigned char previous[FEC_BLOCK_SIZE + 1] = {1};
+    unsigned char temporary[FEC_BLOCK_SIZE + 1];
+    int degree = 0;
+    int shift = 1;
+    unsigned char previousDiscrepancy = 1;
+    for (int n = 0; n < nsym; n++) {
+        unsigned char discrepancy = syndromes[n];
+        for (int i = 1; i <= degree; i++) discrepancy ^= gfMul(locator[i], syndromes[n - i]);
+        if (discrepancy == 0) {
+            shift++;
+            continue;
+        }
+        unsigned char factor = gfDiv(discrepancy, previousDiscrepancy);
+        if (2 * degree <= n) {
+            memcpy(temporary, locator, sizeof(locator));
+            for (int i = 0; i + shift <= nsym; i++) locator[i + shift] ^= gfMul(factor, previous[i]);
+            memcpy(previous, temporary, sizeof(previous));
+            degree = n + 1 - degree;
+            previousDiscrepancy = discrepancy;
+            shift = 1;
+        } else {
+            for (int i = 0; i + shift <= nsym; i++) locator[i + shift] ^= gfMul(factor, previous[i]);
+            shift++;
+        }
+    }
+    if (2 * degree > nsym) return -1;
+
+    // evaluator(x) = S(x) locator(x) mod x^nsym
+    unsigned char evaluator[FEC_BLOCK_SIZE];
+    for (int i = 0; i < nsym; i++) {
+        evaluator[i] = 0;
+        for (int j = 0; j <= i && j <= degree; j++) evaluator[i] ^= gfMul(locator[j], syndromes[i - j]);
+    }
+
+    // Pesquisa de Chien e algoritmo de Forney: o byte j corresponde a X = alpha^(size-1-j)
+    int corrected = 0;
+    int positions[FEC_BLOCK_SIZE];
+    unsigned char magnitudes[FEC_BLOCK_SIZE];
+    for (int j = 0; j < size; j++) {
+        int power = size - 1 - j;
+        unsigned char xInverse = gfInversePower(power);
+        if (evaluate(locator, degree + 1, xInverse) != 0) continue;
+
+        // Derivada formal do localizador: só os termos de grau ímpar
+        unsigned char derivative = 0;
+        unsigned char xInverse2 = gfMul(xInverse, xInverse);
+        unsigned char term = 1;  // xInverse^(i-1), com i ímpar
+        for (int i = 1; i <= degree; i += 2) {
+            derivative ^= gfMul(locator[i], term);
+            term = gfMul(term, xInverse2);
+        }
+        if (derivative == 0) return -1;
+        positions[corrected] = j;
+        magnitudes[corrected] = gfMul(gfExp[power], gfDiv(evaluate(evaluator, nsym, xInverse), derivative));
+        corrected++;
+    }
+    if (corrected != degree) return -1;  // o localizador não tem todas as raízes na palavra de código
+
+    for (int i = 0; i < corrected; i++) codeword[positions[i]] ^= magnitudes[i];
+    return corrected;
+}
@@ -1,14 +1,24 @@
 // Link layer protocol implementation
 
 #include "link_layer.h"
+#include "link_control.h"
+#include "link_handle.h"
+#include "link_stats.h"
 
+#include "crc.h"
+#include "fec.h"
+#include "stuffing.h"
+
+#include <errno.h>
 #include <fcntl.h>
-#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
@@ -19,18 +29,143 @@
 #define FLAG 0x7E
 #define A 0x03
 #define A_CLOSE 0x01
+#define A_ANY 0x00  // em processByte, aceita A ou A_CLOSE (o valor lido fica em aCheck)
 #define C_SET 0x03
 #define C_UA 0x07
-#define C_RR(r) (((r) << 7) | 0x05)
-#define C_REJ(r) (((r) << 7) | 0x01)
 #define C_DISC 0x0B
 
-#define N(s) ((s) << 6)
+// Números de sequência de 3 bits (módulo 8) no campo C
+// O bit menos significativo ocupa a posição do protocolo original (bit 6 em N(s) e bit 7 em RR/REJ) e os restantes ocupam os bits 4 e 5,
+// pelo que, com SEQ_MODULUS = 2, os valores coincidem com os de stop-and-wait (0x00/0x40, 0x05/0x85, 0x01/0x81)
+#define SEQ_BITS(x, lsb) ((((x) & 0x01) << (lsb)) | (((x) & 0x06) << 3))
+#define N(s) SEQ_BITS(s, 6)
+#define C_RR(r) (SEQ_BITS(r, 7) | C_TYPE_RR)
+#define C_REJ(r) (SEQ_BITS(r, 7) | C_TYPE_REJ)
+#define C_SREJ(r) (SEQ_BITS(r, 7) | C_TYPE_SREJ)
+#define NS(c) ((((c) >> 6) & 0x01) | (((c) >> 3) & 0x06))  // N(s) de uma trama I
+#define NR(c) ((((c) >> 7) & 0x01) | (((c) >> 3) & 0x06))  // N(r) de uma trama de supervisão
+
+// Full duplex: as tramas I levam também o N(r) do seu emissor nos bits 1 a 3 (livres), pelo que confirmam as tramas do outro sentido
+#define C_PIGGYBACK(r) (((r) & 0x07) << 1)
+#define C_PIGGYBACK_MASK 0x0E
+#define PIGGYBACK_NR(c) (((c) >> 1) & 0x07)  // N(r) de uma trama I
+
+#define C_MASK_EXACT 0xFF  // compara o campo C por completo
+#define C_MASK_I 0x01      // trama I: bit 0 a 0, qualquer N(s)
+#define C_MASK_S 0x03      // trama de supervisão: bits 0 e 1 a 01, qualquer tipo e N(r)
+#define C_I 0x00
+#define C_S 0x01
+#define C_TYPE(c) ((c) & 0x0F)  // tipo de uma trama de supervisão
+#define C_TYPE_RR 0x05
+#define C_TYPE_REJ 0x01
+#define C_TYPE_SREJ 0x0D
+#define C_POLL 0x40  // bit P das tramas de supervisão (livre em RR/REJ/SREJ): o emissor pede uma confirmação imediata
+#define C_AGGREGATE 0x80  // bit 7 das tramas I (livre): o campo de informação tem vários pacotes (ver AGGREGATE_MODE)
+
+// Protocolo ARQ
+// Go-Back-N: o recetor só aceita tramas por ordem e um REJ ou timeout provoca a retransmissão de todas as tramas por confirmar
+// Selective Repeat: o recetor guarda as tramas fora de ordem e pede com SREJ apenas as que faltam ou chegaram com erros
+#define ARQ_GO_BACK_N 0
+#define ARQ_SELECTIVE_REPEAT 1
+#define ARQ_MODE ARQ_SELECTIVE_REPEAT
+
+// O emissor mantém até WINDOW_SIZE tramas I por confirmar
+// Go-Back-N: WINDOW_SIZE < SEQ_MODULUS; com WINDOW_SIZE = 1 e SEQ_MODULUS = 2 obtém-se o protocolo stop-and-wait original
+// Selective Repeat: WINDOW_SIZE <= SEQ_MODULUS / 2
+#define SEQ_MODULUS 8
+#if ARQ_MODE == ARQ_SELECTIVE_REPEAT
+#define WINDOW_SIZE 4
+#else
+#define WINDOW_SIZE 7
+#endif
+
+// Frame Check Sequence das tramas I
+// O emissor propõe FCS_MODE no SET e o recetor responde no UA com o mais fraco de entre a proposta e o seu FCS_MODE
+#define FCS_XOR 0    // BCC2: XOR de todos os bytes de dados (1 byte)
+#define FCS_CRC16 1  // CRC-16-CCITT (2 bytes)
+#define FCS_CRC32 2  // CRC-32 (4 bytes)
+#define FCS_MODE FCS_CRC32
+#define FCS_MAX_SIZE 4
+
+// FEC (Reed-Solomon): os dados e o FCS de cada trama I são divididos em blocos de até FEC_BLOCK_SIZE - paridade bytes,
+// e os bytes de paridade de cada bloco são enviados a seguir ao FCS; o recetor corrige até paridade / 2 bytes errados
+// por bloco antes de verificar o FCS, evitando a retransmissão. O último byte antes do FLAG final indica a paridade usada
+// na trama, pelo que o emissor a ajusta à fração de tramas retransmitidas sem alterar o formato das tramas
+// Só corrige substituições de bytes: um FLAG ou ESC criado ou destruído pelo ruído continua a obrigar à retransmissão
+#define FEC_PARITY 16          // paridade máxima por bloco proposta no SET (0 -> sem FEC)
+#define FEC_MIN_PARITY 2       // paridade usada quando o FEC é ativado
+#define FEC_ADAPT_INTERVAL 16  // número de tramas I novas entre dois ajustes da paridade
+#define FEC_RAISE_RATE 5       // percentagem de tramas retransmitidas acima da qual a paridade duplica
+#define FEC_QUIET_INTERVALS 4  // intervalos seguidos sem retransmissões ao fim dos quais a paridade passa para metade
+#define FEC_MAX_BLOCKS ((MAX_PAYLOAD_SIZE + FCS_MAX_SIZE + FEC_BLOCK_SIZE - FEC_PARITY - 1) / (FEC_BLOCK_SIZE - FEC_PARITY))
+#define FEC_MAX_SIZE (FEC_PARITY * FEC_MAX_BLOCKS + 1)  // paridade de todos os blocos e indicação da paridade
+
+// Parâmetros da ligação negociados no campo de informação das tramas SET e UA, em TLV (T, L, V)
+#define PARAM_FCS 0
+#define PARAM_MAX_INFO 1  // tamanho máximo do campo de informação das tramas I (2 bytes, o mais significativo primeiro)
+#define PARAM_FEC 2       // paridade FEC máxima por bloco (1 byte, 0 -> sem FEC)
+#define PARAM_AGGREGATE 3  // aceita tramas I agregadas (1 byte, 0 -> sem agregação)
+#define PARAM_DUPLEX 4     // full duplex, com o N(r) nas tramas I (1 byte, 0 -> half duplex)
+#define MAX_PARAMS_SIZE 16
+
+// Tamanho máximo do campo de informação das tramas I
+// O emissor propõe MAX_INFO_SIZE no SET e o recetor responde no UA com o menor de entre a proposta e o seu MAX_INFO_SIZE
+#define MAX_INFO_SIZE MAX_PAYLOAD_SIZE
+
+// Limite inferior do RTO, em milissegundos (o limite superior é o timeout configurado)
+#define RTO_MIN 200
+
+// Confirmações adiadas: o recetor confirma as tramas I aceites com um único RR cumulativo a cada ACK_EVERY tramas ou,
+// se a linha ficar parada, ACK_DELAY milissegundos depois da primeira trama por confirmar (bem abaixo de RTO_MIN)
+// Os erros continuam a ser assinalados de imediato com REJ/SREJ. Quando o emissor fica à espera de todas as confirmações
+// (llflush, llclose) ou recebe uma resposta danificada, envia um RR com o bit C_POLL e o recetor responde de imediato
+// Com metade da janela, o emissor recebe uma confirmação antes de a esgotar; com stop-and-wait (janela 1) cada trama é confirmada
+// Depois de um erro (trama danificada, fora de ordem ou duplicada), as ACK_QUICK tramas seguintes são confirmadas uma a uma:
+// numa linha com ruído, cada RR perdido custaria mais ao emissor do que os RR poupados
+#define ACK_EVERY (WINDOW_SIZE / 2)
+#define ACK_DELAY 40
+#define ACK_QUICK (4 * WINDOW_SIZE)
+
+// Agregação de pacotes pequenos: o emissor propõe AGGREGATE_MODE no SET e o recetor responde no UA se também a aceita
+// Com tramas por confirmar, os pacotes pequenos (até AGGREGATE_MAX_PACKET bytes: pacotes de controlo, fim de um ficheiro) ficam
+// retidos e são enviados juntos numa só trama I, marcada com C_AGGREGATE, em que cada pacote é precedido do seu tamanho
+// (AGGREGATE_PREFIX bytes, o mais significativo primeiro); o recetor entrega-os um a um em llread. A trama agregada não excede
+// o maior dos últimos AGGREGATE_HISTORY pacotes, pelo que não fica maior do que as tramas cujo tamanho a aplicação escolheu
+// (por exemplo, ao reduzir os pacotes de dados numa linha com erros). Os pacotes retidos são enviados quando o seguinte já não
+// cabe na trama ou não é pequeno, quando llwrite é chamado AGGREGATE_DELAY milissegundos ou mais depois do primeiro, e em llflush e llclose
+#define AGGREGATE_MODE TRUE
+#define AGGREGATE_PREFIX 2
+#define AGGREGATE_DELAY 20
+#define AGGREGATE_MAX_PACKET 64
+#define AGGREGATE_HISTORY 8
+
+// Full duplex: o emissor propõe DUPLEX_MODE no SET e o recetor responde no UA se também o aceita
+// Os dois lados podem então escrever e ler ao mesmo tempo, cada um numa thread, e cada trama I enviada confirma (com o N(r) nos
+// bits 1 a 3 do campo C) as tramas aceites do outro sentido, pelo que os RR só são enviados quando não há tramas I a enviar
+// Só uma thread lê da porta série de cada vez e trata todas as tramas recebidas: as respostas às tramas enviadas atualizam a janela e as
+// tramas I recebidas enquanto a ligação escreve ficam no buffer de reordenação até serem entregues em llread (e só então são confirmadas)
+// Uma trama I pode levar o N(r) anterior (ver sendWindowFrame), que só é ignorado com WINDOW_SIZE < SEQ_MODULUS - 1: com a janela de
+// Go-Back-N (7 tramas) confirmaria a janela inteira, pelo que a ligação fica em half duplex
+#define DUPLEX_MODE (WINDOW_SIZE < SEQ_MODULUS - 1)
+
+// Prazo usado nas esperas sem limite de tempo
+#define NO_DEADLINE -1
+
+// Tamanho do buffer de receção, preenchido com leituras em bloco da porta série
+#define RX_BUFFER_SIZE 4096
 
 #define ESC 0x7D
 #define FLAG_ESCAPED 0x5E
 #define ESC_ESCAPED 0x5D
 
+// Tamanho máximo de uma trama SET ou UA codificada
+#define MAX_PARAMETER_FRAME_SIZE (4 + 2 * (MAX_PARAMS_SIZE + FCS_MAX_SIZE) + 1)
+
+// Tamanhos das partes de uma trama I codificada
+#define HEADER_SIZE 4                            // F A C BCC1
+#define MAX_STUFFED_SIZE (2 * MAX_PAYLOAD_SIZE)  // dados após o stuffing, no pior caso (todos os bytes são FLAG ou ESC)
+#define MAX_TRAILER_SIZE (2 * (FCS_MAX_SIZE + FEC_MAX_SIZE) + 1)  // FCS e FEC após o stuffing e F
+
 typedef enum {
     START_STATE,
     FLAG_RCV_STATE,
@@ -40,44 +175,147 @@ typedef enum {
     STOP_STATE
 } State;
 
-int fd;
-int alarmEnabled = FALSE;
-int alarmCount = 0;
-int nRetransmissions;
-int timeout;
-LinkLayerRole role;
-
-// Estatísticas
-clock_t start;
-int totalTramas = 0;
-int totalTramasI = 0;
-int totalTramasSU = 0;
-int totalSET = 0;
-int totalUA = 0;
-int totalRR = 0;
-int totalREJ = 0;
-int totalDISC = 0;
-int totalBytes = 0;
-int totalRetransmissions = 0;
-int totalBCC1 = 0;
-int totalBCC2 = 0;
-int totalDuplicados = 0;
-int totalOpen = 0;
-int totalWrite = 0;
-int totalRead = 0;
-int totalClose = 0;
-int totalStuffed = 0;
-int totalFlagStuffed = 0;
-int totalEscStuffed = 0;
+// Estado de uma ligação: cada ligação aberta com linkOpen tem o seu, pelo que um processo pode usar várias portas série ao mesmo tempo
+// (em full duplex, uma thread pode escrever enquanto outra lê; caso contrário, só uma thread de cada vez)
+struct LinkHandle {
+    int fd;
+    int alarmCount;  // número de temporizadores que expiraram
+    int nRetransmissions;
+    int timeout;
+    int fcsMode;      // FCS negociado em llopen
+    int maxInfoSize;  // tamanho máximo do campo de informação negociado em llopen
+    int fecMax;       // paridade FEC máxima negociada em llopen (0 -> sem FEC)
+    int aggregateAccepted;  // o outro lado aceitou tramas agregadas em llopen
+    int aggregation;        // os pacotes pequenos são agregados (aceite e não desativada com linkSetAggregation)
+    int duplex;             // full duplex negociado em llopen: as tramas I levam o N(r)
+
+    // Duas threads podem usar a ligação ao mesmo tempo (uma a escrever e outra a ler): o estado da ligação é protegido por lock,
+    // libertado enquanto uma delas espera por bytes da porta série ou por changed
+    pthread_mutex_t lock;
+    pthread_cond_t changed;  // assinalada quando a janela avança, quando fica uma trama guardada para llread ou quando a porta série fica livre
+    int reading;             // uma thread está a ler da porta série (só uma de cada vez)
+    int cancelState;         // estado de cancelamento da thread de llread enquanto espera por bytes (ver waitReadable)
+    int hungUp;              // a porta série deixou de estar ligada (ver waitReadable): todas as leituras falham
+
+    // Paridade FEC das tramas I enviadas, ajustada a cada FEC_ADAPT_INTERVAL tramas
+    int fecParity;
+    int fecFrames;           // tramas I novas desde o último ajuste
+    int fecRetransmissions;  // valor de totalRetransmissions no último ajuste
+    int fecQuietIntervals;   // intervalos seguidos sem retransmissões
+
+    // Estimativa do RTT e do RTO (RFC 6298), em milissegundos
+    long long srtt;    // RTT suavizado
+    long long rttvar;  // variação do RTT
+    long long rto;     // prazo de retransmissão atual
+    long long rtoMax;  // o RTO nunca excede o timeout configurado
+    int rttMeasured;   // já foi obtida pelo menos uma amostra do RTT
+    LinkLayerRole role;
+
+    // Buffer de receção: os bytes são lidos da porta série em bloco e consumidos um a um pela máquina de estados e pelo destuffing
+    unsigned char rxBuffer[RX_BUFFER_SIZE];
+    int rxHead;  // posição do próximo byte a consumir
+    int rxTail;  // posição a seguir ao último byte lido
+
+    // Janela do emissor (indexada pelo número de sequência)
+    // Cada trama fica codificada em buffers fixos (cabeçalho, dados e fim), que são reutilizados nas retransmissões
+    unsigned char windowHeaders[SEQ_MODULUS][HEADER_SIZE];
+    unsigned char windowBodies[SEQ_MODULUS][MAX_STUFFED_SIZE];
+    int windowBodySizes[SEQ_MODULUS];
+    unsigned char windowTrailers[SEQ_MODULUS][MAX_TRAILER_SIZE];
+    int windowTrailerSizes[SEQ_MODULUS];
+    long long windowDeadlines[SEQ_MODULUS];  // instante (relógio monotónico, em milissegundos) em que a trama deve ser retransmitida
+    long long windowSentAt[SEQ_MODULUS];     // instante do último envio da trama
+    int windowRetransmitted[SEQ_MODULUS];    // a trama já foi retransmitida, pelo que não serve para medir o RTT (regra de Karn)
+    int windowTries[SEQ_MODULUS];            // tentativas de retransmissão restantes para a trama
+    unsigned char base;                      // número de sequência da trama mais antiga por confirmar
+    unsigned char nextSeq;                   // número de sequência da próxima trama a enviar
+    int outstanding;                         // número de tramas enviadas e por confirmar
+    int polled;                              // já foi pedida a confirmação imediata das tramas por confirmar (C_POLL)
+
+    // Pacotes pequenos retidos para a próxima trama agregada, cada um precedido do seu tamanho
+    unsigned char aggregate[MAX_PAYLOAD_SIZE];
+    int aggregateSize;
+    int aggregateCount;
+    long long aggregateDeadline;  // instante a partir do qual llwrite envia os pacotes retidos
+    int recentSizes[AGGREGATE_HISTORY];  // tamanhos dos últimos pacotes escritos (ver aggregateLimit)
+    int recentHead;
+
+    // Estado do recetor
+    unsigned char expectedSeq;  // número de sequência da próxima trama esperada
+    int rejSent;                // já foi enviado um REJ para a falha atual
+    int ackPending;             // tramas aceites ainda não confirmadas por um RR
+    int quickAcks;              // tramas a confirmar uma a uma depois de um erro (ver ACK_QUICK)
+    long long ackDeadline;      // instante até ao qual a confirmação das tramas aceites pode esperar
+
+    // Buffer de reordenação do recetor (tramas fora de ordem ou recebidas durante llwrite), com uma posição por número de sequência
+    unsigned char reorderBuffer[SEQ_MODULUS][MAX_PAYLOAD_SIZE];
+    int reorderSizes[SEQ_MODULUS];
+    int reorderReceived[SEQ_MODULUS];  // a trama já foi recebida e aguarda ser entregue
+    int srejSent[SEQ_MODULUS];         // já foi enviado um SREJ para a trama
+    unsigned char nextArrival;         // número de sequência a seguir ao da trama mais avançada recebida (a próxima que o emissor envia)
+    int reorderAggregated[SEQ_MODULUS];  // a trama guardada é agregada
+
+    // Trama agregada recebida, cujos pacotes são entregues um a um
+    unsigned char unpackBuffer[MAX_PAYLOAD_SIZE];
+    int unpackSize;
+    int unpackHead;  // posição do tamanho do próximo pacote a entregar
+
+    // Última trama SET ou UA enviada, guardada para responder a um SET repetido (o UA perdeu-se) já depois de llopen
+    unsigned char parameterFrame[MAX_PARAMETER_FRAME_SIZE];
+    int parameterFrameSize;
+
+    // Estatísticas
+    long long start;
+    int totalTramas;
+    int totalTramasI;
+    int totalTramasSU;
+    int totalSET;
+    int totalUA;
+    int totalRR;
+    int totalPolls;  // RR com o bit C_POLL enviados pelo emissor
+    int totalPiggyback;  // tramas I enviadas que confirmaram tramas do outro sentido (full duplex)
+    int totalREJ;
+    int totalSREJ;
+    int totalDISC;
+    int totalBytes;
+    int totalRetransmissions;
+    int totalBCC1;
+    int totalBCC2;
+    int totalRejeitadas;  // REJ e SREJ recebidos
+    int totalFecBytes;    // bytes corrigidos pelo FEC
+    int totalFecTramas;   // tramas com pelo menos um byte corrigido pelo FEC
+    int totalAgregadas;          // tramas I agregadas enviadas
+    int totalPacotesAgregados;   // pacotes enviados em tramas agregadas
+    int totalDuplicados;
+    int totalForaDeOrdem;
+    int totalDanificadas;  // tramas com o cabeçalho danificado (A, C ou BCC1 errados)
+    int totalRetransmissoesRapidas;  // retransmissões sem esperar pelo temporizador, depois de uma resposta danificada
+    int totalOpen;
+    int totalWrite;
+    int totalRead;
+    int totalClose;
+    int totalFlush;
+    int totalStuffed;
+    int totalFlagStuffed;
+    int totalEscStuffed;
+};
+
+// As tabelas do CRC, do stuffing e do FEC são partilhadas por todas as ligações e calculadas uma única vez
+pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
 
 // Imprime "Link Layer" seguido do título e do conteúdo
 void printLL(char *title, unsigned char *content, int contentSize) {
     // DEBUG
+    int cancelState;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelState);  // um pthread_cancel a meio deixaria o stdout inconsistente
+    flockfile(stdout);  // a camada de aplicação pode imprimir a partir de outra thread
     printf("\nLink Layer\n");
     for (int i = 0; title[i] != '\0'; i++) printf("%c", title[i]);
     printf("\n");
     for (int i = 0; i < contentSize; i++) printf("0x%x ", content[i]);
     printf("\n");
+    funlockfile(stdout);
+    pthread_setcancelstate(cancelState, NULL);
 }
 
 // Converte int em speed_t
@@ -104,21 +342,181 @@ speed_t get_baudrate(int baudrate) {
     }
 }
 
-// Lida com uma interrupção do alarme: desativa-o, incrementa um contador e imprime "ALARM"
-void alarmHandler(int signal) {
-    alarmEnabled = FALSE;
-    alarmCount++;
+// Retorna o instante atual do relógio monotónico, em milissegundos
+long long monotonicMillis() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Lida com a expiração de um temporizador: incrementa um contador e imprime "ALARM"
+void timerExpired(LinkHandle *link) {
+    link->alarmCount++;
     printf("\nALARM\n");
 }
 
+// Atualiza o RTT suavizado, a sua variação e o RTO com uma nova amostra do RTT
+// Só são usadas amostras de tramas que não foram retransmitidas (regra de Karn)
+void updateRto(LinkHandle *link, long long sample) {
+    if (link->rttMeasured == FALSE) {
+        link->srtt = sample;
+        link->rttvar = sample / 2;
+        link->rttMeasured = TRUE;
+    } else {
+        long long delta = link->srtt > sample ? link->srtt - sample : sample - link->srtt;
+        link->rttvar = (3 * link->rttvar + delta) / 4;  // beta = 1/4
+        link->srtt = (7 * link->srtt + sample) / 8;     // alpha = 1/8
+    }
+    link->rto = link->srtt + (4 * link->rttvar > 1 ? 4 * link->rttvar : 1);  // K = 4, G = 1 ms
+    if (link->rto < RTO_MIN) link->rto = RTO_MIN;
+    if (link->rto > link->rtoMax) link->rto = link->rtoMax;
+}
+
+// Backoff exponencial: duplica o RTO após um timeout, até ao timeout configurado
+void backoffRto(LinkHandle *link) {
+    link->rto = 2 * link->rto < link->rtoMax ? 2 * link->rto : link->rtoMax;
+}
+
+// Deixa a porta série livre para a outra thread
+void releaseReading(LinkHandle *link) {
+    link->reading = FALSE;
+    link->cancelState = PTHREAD_CANCEL_DISABLE;
+    pthread_cond_broadcast(&link->changed);
+}
+
+// Deixa a porta série livre quando a thread de llread é cancelada à espera de bytes (pthread_cleanup_push)
+void abandonReading(void *arg) {
+    LinkHandle *link = arg;
+    pthread_mutex_lock(&link->lock);
+    releaseReading(link);
+    pthread_mutex_unlock(&link->lock);
+}
+
+// Marca a porta série como desligada e acorda a outra thread, que pode estar à espera de que esta mude o estado da ligação
+void hangUp(LinkHandle *link) {
+    if (!link->hungUp) printf("A porta série deixou de estar ligada\n");
+    link->hungUp = TRUE;
+    pthread_cond_broadcast(&link->changed);
+}
+
+// Retorna o tempo que falta até ao instante 'deadline', em ms, como timeout de poll() (NO_DEADLINE -> -1, sem limite)
+int pollTimeout(long long deadline) {
+    if (deadline == NO_DEADLINE) return -1;
+    long long remaining = deadline - monotonicMillis();
+    return remaining > 0 ? remaining : 0;
+}
+
+// Espera, sem ocupar o processador, até haver bytes para ler na porta série ou até ao instante 'deadline' (NO_DEADLINE -> sem limite)
+// Durante a espera, a outra thread (full duplex) pode usar a ligação, mas não ler da porta série (ver reading)
+// É o único ponto em que a thread de llread pode ser cancelada: nos restantes, seguraria lock
+// Se a porta série deixar de estar ligada (o outro lado do pty ou do cabo desapareceu), poll() retorna logo com POLLHUP,
+// POLLERR ou POLLNVAL: a ligação fica marcada (hungUp), porque voltar a esperar ocuparia o processador sem fim
+// Retorna 1 se há bytes para ler, 0 se o prazo expirou, -1 se a porta série deixou de estar ligada
+int waitReadable(LinkHandle *link, long long deadline) {
+    if (pollTimeout(deadline) == 0) return 0;
+    struct pollfd pfd = {.fd = link->fd, .events = POLLIN};
+    int cancelState = link->cancelState;
+    int ready;
+    pthread_mutex_unlock(&link->lock);
+    pthread_cleanup_push(abandonReading, link);
+    pthread_setcancelstate(cancelState, &cancelState);
+    do {
+        ready = poll(&pfd, 1, pollTimeout(deadline));  // sem variáveis alteradas antes de pthread_cleanup_push (setjmp)
+    } while (ready < 0 && errno == EINTR);
+    pthread_setcancelstate(cancelState, NULL);
+    pthread_cleanup_pop(FALSE);
+    pthread_mutex_lock(&link->lock);
+    if (ready < 0 || (ready > 0 && !(pfd.revents & POLLIN) && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)))) {
+        hangUp(link);
+        return -1;
+    }
+    return ready > 0;
+}
+
+// Espera que a thread que está a ler da porta série mude o estado da ligação (ou a deixe livre), ou até ao instante 'deadline'
+// Retorna 1 se o estado pode ter mudado, 0 se o prazo expirou
+int waitChanged(LinkHandle *link, long long deadline) {
+    if (deadline == NO_DEADLINE) return pthread_cond_wait(&link->changed, &link->lock) == 0;
+    struct timespec until = {deadline / 1000, (deadline % 1000) * 1000000};
+    return pthread_cond_timedwait(&link->changed, &link->lock, &until) != ETIMEDOUT;
+}
+
+// Envia uma trama de supervisão (RR, REJ ou SREJ) com o campo C dado
+// O N(r) de um RR ou REJ do recetor confirma todas as tramas aceites, pelo que deixam de existir confirmações pendentes
+void sendSupervisionFrame(LinkHandle *link, char *title, unsigned char c) {
+    unsigned char frame[5] = {FLAG, A, c, A ^ c, FLAG};
+    printLL(title, frame, sizeof(frame));  // DEBUG
+    link->totalTramas++;
+    link->totalTramasSU++;
+    if (C_TYPE(c) != C_TYPE_SREJ && !(c & C_POLL)) link->ackPending = 0;
+    if (c & C_POLL)
+        link->totalPolls++;
+    else if (C_TYPE(c) == C_TYPE_RR)
+        link->totalRR++;
+    else if (C_TYPE(c) == C_TYPE_REJ)
+        link->totalREJ++;
+    else if (C_TYPE(c) == C_TYPE_SREJ)
+        link->totalSREJ++;
+    write(link->fd, frame, sizeof(frame));
+}
+
+// Envia o RR cumulativo das tramas aceites que ainda não foram confirmadas (ver ACK_EVERY)
+void acknowledgePending(LinkHandle *link, char *title) {
+    if (link->ackPending > 0) sendSupervisionFrame(link, title, C_RR(link->expectedSeq));
+}
+
+// Se o buffer de receção estiver vazio, lê da porta série tudo o que estiver disponível,
+// esperando com poll() até chegarem bytes ou até ao instante 'deadline'
+// Se a espera passar o prazo das tramas aceites por confirmar (ackDeadline), envia o seu RR, mesmo a meio de uma trama:
+// uma trama interrompida (FLAG final perdido) só termina com as tramas seguintes, que o emissor pode estar a reter
+// read() sem bytes depois de poll() os ter indicado, ou com um erro que não seja EAGAIN/EINTR, é uma porta série desligada
+// Retorna 1 se há bytes no buffer de receção, 0 se o prazo expirou, -1 se a porta série deixou de estar ligada
+int fillRxBuffer(LinkHandle *link, long long deadline) {
+    int readable = FALSE;  // poll() indicou bytes para ler
+    while (link->rxHead == link->rxTail) {
+        if (link->hungUp) return -1;
+        int bytesRead = read(link->fd, link->rxBuffer, RX_BUFFER_SIZE);
+        if (bytesRead > 0) {
+            printLL("Bytes Lidos", link->rxBuffer, bytesRead);  // DEBUG
+            link->rxHead = 0;
+            link->rxTail = bytesRead;
+            continue;
+        }
+        if ((bytesRead == 0 && readable) || (bytesRead < 0 && errno != EAGAIN && errno != EINTR)) {
+            hangUp(link);
+            return -1;
+        }
+        int acknowledging = link->ackPending > 0 && (deadline == NO_DEADLINE || link->ackDeadline < deadline);
+        int ready = waitReadable(link, acknowledging ? link->ackDeadline : deadline);
+        if (ready < 0) return -1;
+        if (ready == 0 && !acknowledging) return 0;
+        if (ready == 0) acknowledgePending(link, "LLREAD - RR enviado (temporizador)");
+        readable = ready > 0;
+    }
+    return 1;
+}
+
+// Coloca em byte o próximo byte recebido
+// Retorna 1 se foi obtido um byte, 0 se o prazo expirou, -1 se a porta série deixou de estar ligada
+int readByte(LinkHandle *link, unsigned char *byte, long long deadline) {
+    int ready = fillRxBuffer(link, deadline);
+    if (ready <= 0) return ready;
+    *byte = link->rxBuffer[link->rxHead++];
+    link->totalBytes++;
+    return 1;
+}
+
 /**
  * Máquina de estados que processa cada byte lido da porta série
- * @param a valor esperado no campo A
+ * @param a valor esperado no campo A (A_ANY -> A ou A_CLOSE)
  * @param c1 um dos possíveis valores esperados no campo C
  * @param c2 outro dos possíveis valores esperados no campo C
+ * @param cMask máscara aplicada ao campo C antes de o comparar com c1 e c2
  * @param aCheck valor lido do campo A
  * @param cCheck valor lido do campo C
  * @param state estado atual
+ * @param deadline instante até ao qual se espera por um byte (NO_DEADLINE -> sem limite)
+ * @return 1 se foi lido um byte, 0 se o prazo expirou, -1 se a porta série deixou de estar ligada
  *
  * @details
  * A existência dos parâmetros c1 e c2 permite aproveitar a mesma máquina de estados para llopen, llwrite, llread e llclose
@@ -126,68 +524,423 @@ void alarmHandler(int signal) {
  * Em llread, existem dois valores esperados para o campo C (C_RR e C_REJ), pelo que c1 != c2
  * Em llwrite, existem dois valores esperados para o campo C (N(0) e N(1)), pelo que c1 != c2
  * Em llclose, só existe um valor esperado para o campo C (C_DISC), pelo que c1 = c2
+ * Com janela, o número de sequência (e o tipo de supervisão) é ignorado através de cMask (C_MASK_I ou C_MASK_S) e interpretado por quem chama
+ * Um cabeçalho danificado faz a máquina voltar a START_STATE a partir de outro estado (ver headerDamaged)
  */
-void processByte(unsigned char a, unsigned char c1, unsigned char c2, unsigned char *aCheck, unsigned char *cCheck, State *state) {
+int processByte(LinkHandle *link, unsigned char a, unsigned char c1, unsigned char c2, unsigned char cMask, unsigned char *aCheck, unsigned char *cCheck, State *state, long long deadline) {
     unsigned char byteRead;
 
-    if (read(fd, &byteRead, sizeof(byteRead)) == sizeof(byteRead)) {
-        totalBytes++;
-        printLL("Byte Lido", &byteRead, sizeof(byteRead));  // DEBUG
-        switch (*state) {
-            case START_STATE:
-                if (byteRead == FLAG)
-                    *state = FLAG_RCV_STATE;
-                else
-                    *state = START_STATE;
-                break;
-            case FLAG_RCV_STATE:
-                if (byteRead == FLAG)
-                    *state = FLAG_RCV_STATE;
-                else if (byteRead == a) {
-                    *aCheck = byteRead;
-                    *state = A_RCV_STATE;
-                } else
-                    *state = START_STATE;
-                break;
-            case A_RCV_STATE:
-                if (byteRead == FLAG)
-                    *state = FLAG_RCV_STATE;
-                else if (byteRead == c1 || byteRead == c2) {
-                    *cCheck = byteRead;
-                    *state = C_RCV_STATE;
-                } else
-                    *state = START_STATE;
-                break;
-            case C_RCV_STATE:
-                if (byteRead == FLAG)
-                    *state = FLAG_RCV_STATE;
-                else if (byteRead == (*aCheck ^ *cCheck))
-                    *state = BCC_OK_STATE;
-                else {
-                    totalBCC1++;
-                    *state = START_STATE;
-                }
-                break;
-            case BCC_OK_STATE:
-                if (byteRead == FLAG)
-                    *state = STOP_STATE;
-                else
-                    *state = START_STATE;
-                break;
-            default:
-                break;
+    int ready = readByte(link, &byteRead, deadline);
+    if (ready <= 0) return ready;
+    switch (*state) {
+        case START_STATE:
+            if (byteRead == FLAG)
+                *state = FLAG_RCV_STATE;
+            else
+                *state = START_STATE;
+            break;
+        case FLAG_RCV_STATE:
+            if (byteRead == FLAG)
+                *state = FLAG_RCV_STATE;
+            else if (byteRead == a || (a == A_ANY && (byteRead == A || byteRead == A_CLOSE))) {
+                *aCheck = byteRead;
+                *state = A_RCV_STATE;
+            } else
+                *state = START_STATE;
+            break;
+        case A_RCV_STATE:
+            if (byteRead == FLAG)
+                *state = FLAG_RCV_STATE;
+            else if ((byteRead & cMask) == c1 || (byteRead & cMask) == c2) {
+                *cCheck = byteRead;
+                *state = C_RCV_STATE;
+            } else
+                *state = START_STATE;
+            break;
+        case C_RCV_STATE:
+            if (byteRead == FLAG)
+                *state = FLAG_RCV_STATE;
+            else if (byteRead == (*aCheck ^ *cCheck))
+                *state = BCC_OK_STATE;
+            else {
+                link->totalBCC1++;
+                *state = START_STATE;
+            }
+            break;
+        case BCC_OK_STATE:
+            if (byteRead == FLAG)
+                *state = STOP_STATE;
+            else
+                *state = START_STATE;
+            break;
+        default:
+            break;
+    }
+    return 1;
+}
+
+// Retorna TRUE se o último byte processado fez a máquina de estados abandonar um cabeçalho já começado,
+// isto é, se a trama chegou com o campo A, C ou BCC1 errado (o resto da trama é ignorado até ao próximo FLAG)
+int headerDamaged(State previous, State state) {
+    return state == START_STATE && previous != START_STATE;
+}
+
+// Retorna o número de bytes do FCS no modo negociado
+int fcsLength(LinkHandle *link) {
+    if (link->fcsMode == FCS_CRC32) return 4;
+    if (link->fcsMode == FCS_CRC16) return 2;
+    return 1;
+}
+
+// Retorna o valor inicial do registo do FCS no modo negociado (também usado na inversão final)
+unsigned int fcsInitial(LinkHandle *link) {
+    if (link->fcsMode == FCS_CRC32) return 0xFFFFFFFF;
+    if (link->fcsMode == FCS_CRC16) return 0xFFFF;
+    return 0;
+}
+
+// Atualiza o registo do FCS com 'size' bytes de dados, no modo negociado
+unsigned int updateFcs(LinkHandle *link, unsigned int reg, const unsigned char *data, int size) {
+    if (link->fcsMode == FCS_CRC32) return crc32Update(reg, data, size);
+    if (link->fcsMode == FCS_CRC16) return crc16Update(reg, data, size);
+    for (int i = 0; i < size; i++) {
+        // Cálculo do BCC2
+        reg ^= data[i];
+    }
+    return reg;
+}
+
+// Termina o cálculo do FCS e coloca-o em fcs (byte menos significativo primeiro)
+// Retorna o número de bytes do FCS
+int finishFcs(LinkHandle *link, unsigned int reg, unsigned char *fcs) {
+    reg ^= fcsInitial(link);
+    int size = fcsLength(link);
+    for (int i = 0; i < size; i++) fcs[i] = reg >> (8 * i);
+    return size;
+}
+
+// Calcula o FCS dos dados, no modo negociado, e coloca-o em fcs (byte menos significativo primeiro)
+// Retorna o número de bytes do FCS
+int computeFcs(LinkHandle *link, const unsigned char *data, int size, unsigned char *fcs) {
+    return finishFcs(link, updateFcs(link, fcsInitial(link), data, size), fcs);
+}
+
+// Faz o stuffing de 'size' bytes de src para dest (com espaço para o pior caso: 2 * size)
+// Retorna o número de bytes escritos em dest
+int stuff(LinkHandle *link, const unsigned char *src, int size, unsigned char *dest) {
+    int index = stuffBytes(src, size, dest, &link->totalFlagStuffed, &link->totalEscStuffed);
+    link->totalStuffed += index - size;
+    return index;
+}
+
+// Consome os bytes recebidos até ao FLAG final da trama, ignorando-os
+void discardFrame(LinkHandle *link) {
+    while (fillRxBuffer(link, NO_DEADLINE) > 0) {
+        unsigned char *flag = memchr(link->rxBuffer + link->rxHead, FLAG, link->rxTail - link->rxHead);
+        int consumed = flag == NULL ? link->rxTail - link->rxHead : flag - (link->rxBuffer + link->rxHead) + 1;
+        link->rxHead += consumed;
+        link->totalBytes += consumed;
+        if (flag != NULL) return;
+    }
+}
+
+// Campo de informação de uma trama recebida: as posições entre 'split' e dataEnd ficam em data, as restantes até 'capacity'
+// ficam na mesma posição de packet e as seguintes (o fim do FCS de um pacote de tamanho máximo e o FEC) em tail
+// Sem destino escolhido pelo chamador (place), dataEnd é 'split', pelo que os dados ficam todos seguidos em packet
+typedef struct {
+    unsigned char *packet;
+    int split;
+    unsigned char *data;
+    int dataEnd;
+    int capacity;
+    int limit;            // número máximo de bytes do campo de informação (dados, FCS e FEC)
+    unsigned char tail[FCS_MAX_SIZE + FEC_MAX_SIZE];
+    LinkPlacement place;  // chamada quando chegam as primeiras 'split' posições, ou NULL
+    void *context;
+    int placed;           // os dados a seguir a 'split' foram para o destino escolhido por place
+} FrameData;
+
+// Retorna o número de blocos FEC de uma mensagem (dados e FCS) de 'size' bytes com 'nsym' bytes de paridade por bloco
+int fecBlocks(int size, int nsym) {
+    return (size + FEC_BLOCK_SIZE - nsym - 1) / (FEC_BLOCK_SIZE - nsym);
+}
+
+// Retorna o número máximo de bytes do campo de informação de uma trama com até 'capacity' bytes de dados
+int frameLimit(LinkHandle *link, int capacity) {
+    int fcsSize = fcsLength(link);
+    return capacity + fcsSize + (link->fecMax > 0 ? link->fecMax * fecBlocks(capacity + fcsSize, link->fecMax) + 1 : 0);
+}
+
+// Prepara frame para receber até 'capacity' bytes de dados em packet
+void initFrameData(LinkHandle *link, FrameData *frame, unsigned char *packet, int capacity) {
+    frame->packet = packet;
+    frame->split = capacity;
+    frame->data = NULL;
+    frame->dataEnd = capacity;
+    frame->capacity = capacity;
+    frame->limit = frameLimit(link, capacity);
+    frame->place = NULL;
+    frame->context = NULL;
+    frame->placed = FALSE;
+}
+
+// Retorna a posição 'position' do campo de informação de uma trama repartido por packet, data e tail (ver FrameData)
+// e, em run, o número de posições seguidas a partir dela
+unsigned char *frameByte(FrameData *frame, int position, int *run) {
+    if (position < frame->split) {
+        *run = frame->split - position;
+        return frame->packet + position;
+    }
+    if (position < frame->dataEnd) {
+        *run = frame->dataEnd - position;
+        return frame->data + (position - frame->split);
+    }
+    if (position < frame->capacity) {
+        *run = frame->capacity - position;
+        return frame->packet + position;
+    }
+    *run = frame->limit - position;
+    return frame->tail + (position - frame->capacity);
+}
+
+// Pede ao chamador o destino dos dados a seguir às primeiras 'split' posições, já recebidas
+void placeFrameData(FrameData *frame) {
+    int capacity;
+    unsigned char *data = frame->place(frame->context, frame->packet, frame->split, &capacity);
+    frame->place = NULL;
+    if (data == NULL) return;
+    if (capacity > frame->capacity - frame->split) capacity = frame->capacity - frame->split;
+    frame->data = data;
+    frame->dataEnd = frame->split + capacity;
+    frame->placed = TRUE;
+}
+
+// Os dados não couberam no destino escolhido pelo chamador: os que lá ficaram voltam para packet
+void unplaceFrameData(FrameData *frame) {
+    memcpy(frame->packet + frame->split, frame->data, frame->dataEnd - frame->split);
+    frame->dataEnd = frame->split;
+    frame->placed = FALSE;
+}
+
+// Acrescenta n bytes (após o destuffing) ao campo de informação de uma trama, repartido por packet, data e tail
+// Retorna -1 se o campo de informação exceder o limite
+int appendFrameData(FrameData *frame, int *received, const unsigned char *src, int n) {
+    if (*received + n > frame->limit) return -1;
+    while (n > 0) {
+        // Os primeiros bytes (o cabeçalho do pacote) já chegaram, pelo que o chamador pode escolher o destino dos restantes
+        if (*received == frame->split && frame->place != NULL) placeFrameData(frame);
+        int run;
+        unsigned char *dest = frameByte(frame, *received, &run);
+        if (run > n) run = n;
+        memcpy(dest, src, run);
+        *received += run;
+        src += run;
+        n -= run;
+    }
+    return 1;
+}
+
+// Calcula o FCS dos primeiros 'size' bytes do campo de informação de uma trama e coloca-o em fcs
+void frameFcs(LinkHandle *link, FrameData *frame, int size, unsigned char *fcs) {
+    unsigned int reg = fcsInitial(link);
+    for (int position = 0; position < size;) {
+        int run;
+        unsigned char *data = frameByte(frame, position, &run);
+        if (run > size - position) run = size - position;
+        reg = updateFcs(link, reg, data, run);
+        position += run;
+    }
+    finishFcs(link, reg, fcs);
+}
+
+/**
+ * Corrige com o FEC o campo de informação de uma trama (dados, FCS e paridade, repartidos por packet, data e tail)
+ * @param received número de bytes recebidos, sem a indicação da paridade
+ * @param nsym paridade por bloco indicada na trama
+ * @return número de bytes de dados e FCS, ou -1 se a paridade for inválida ou algum bloco tiver demasiados erros
+ *
+ * @details
+ * Todos os blocos têm FEC_BLOCK_SIZE bytes com a paridade, exceto o último, pelo que o número de blocos e o tamanho
+ * da mensagem resultam do número de bytes recebidos
+ */
+int correctFrame(LinkHandle *link, FrameData *frame, int received, int nsym) {
+    if (nsym == 0) return received;
+    if (nsym > link->fecMax) return -1;
+    int blocks = (received + FEC_BLOCK_SIZE - 1) / FEC_BLOCK_SIZE;
+    int messageSize = received - nsym * blocks;
+    int blockSize = FEC_BLOCK_SIZE - nsym;
+    if (messageSize <= (blocks - 1) * blockSize) return -1;
+
+    int corrected = 0;
+    int run;
+    for (int b = 0; b < blocks; b++) {
+        unsigned char codeword[FEC_BLOCK_SIZE];
+        int begin = b * blockSize;
+        int length = messageSize - begin < blockSize ? messageSize - begin : blockSize;
+        for (int i = 0; i < length; i++) codeword[i] = *frameByte(frame, begin + i, &run);
+        for (int i = 0; i < nsym; i++) codeword[length + i] = *frameByte(frame, messageSize + b * nsym + i, &run);
+
+        int errors = rsDecode(codeword, length + nsym, nsym);
+        if (errors < 0) return -1;
+        if (errors == 0) continue;
+        for (int i = 0; i < length; i++) *frameByte(frame, begin + i, &run) = codeword[i];
+        corrected += errors;
+    }
+    if (corrected > 0) {
+        link->totalFecBytes += corrected;
+        link->totalFecTramas++;
+    }
+    return messageSize;
+}
+
+/**
+ * Lê o campo de informação de uma trama (após o BCC1), faz o destuffing e verifica o FCS
+ * @param frame destino dos dados (ver FrameData)
+ * @param deadline instante até ao qual se espera pelo fim da trama (NO_DEADLINE -> sem limite)
+ * @return número de bytes de dados, ou -1 se o FCS estiver incorreto ou o prazo expirar
+ *
+ * @details
+ * Os bytes entre dois FLAG/ESC são copiados de uma vez do buffer de receção (findSpecial), pelo que só os bytes
+ * que sofreram stuffing são tratados individualmente.
+ * O FCS é recebido a seguir aos dados, pelo que pode ocupar as posições de packet a seguir ao pacote.
+ * Com FEC, os erros são corrigidos antes de verificar o FCS.
+ * Os dados que excedam o destino escolhido por place ficam em packet, para onde volta também o que lá foi colocado
+ */
+int readFrameInto(LinkHandle *link, FrameData *frame, long long deadline) {
+    unsigned char byteRead;
+    int fcsSize = fcsLength(link);
+    int received = 0;  // bytes de dados, FCS e FEC recebidos
+
+    while (TRUE) {
+        // Enquanto não for lido o FLAG final, processa os bytes recebidos
+        if (fillRxBuffer(link, deadline) <= 0) return -1;
+        int run = findSpecial(link->rxBuffer + link->rxHead, link->rxTail - link->rxHead);
+        if (appendFrameData(frame, &received, link->rxBuffer + link->rxHead, run) < 0) {
+            // Trama demasiado longa - foi perdido um FLAG
+            discardFrame(link);
+            return -1;
         }
+        link->rxHead += run;
+        link->totalBytes += run;
+        if (link->rxHead == link->rxTail) continue;
+
+        if (readByte(link, &byteRead, deadline) <= 0) return -1;
+        if (byteRead == FLAG) break;
+
+        // Destuffing do byte a seguir ao ESC
+        if (readByte(link, &byteRead, deadline) <= 0) return -1;
+        if (byteRead == FLAG) return -1;  // trama interrompida
+        if (byteRead == FLAG_ESCAPED) {
+            link->totalStuffed++;
+            link->totalFlagStuffed++;
+            byteRead = FLAG;
+        } else if (byteRead == ESC_ESCAPED) {
+            link->totalStuffed++;
+            link->totalEscStuffed++;
+            byteRead = ESC;
+        } else {
+            continue;
+        }
+        if (appendFrameData(frame, &received, &byteRead, 1) < 0) {
+            discardFrame(link);
+            return -1;
+        }
+    }
+
+    if (link->fecMax > 0) {
+        // O último byte indica a paridade FEC da trama
+        if (received == 0) return -1;
+        received--;
+        int run;
+        received = correctFrame(link, frame, received, *frameByte(frame, received, &run));
+    }
+    if (received < fcsSize) return -1;  // trama sem campo de dados nem FCS
+    int size = received - fcsSize;
+    if (size > frame->capacity) return -1;  // dados que não cabem em packet
+    if (frame->placed && size > frame->dataEnd) unplaceFrameData(frame);  // nem no destino escolhido por place
+    printLL("LLREAD - pacote recebido", frame->packet, size < frame->split ? size : frame->split);  // DEBUG
+    unsigned char fcs[FCS_MAX_SIZE];
+    frameFcs(link, frame, size, fcs);
+    for (int i = 0; i < fcsSize; i++) {
+        int run;
+        if (*frameByte(frame, size + i, &run) != fcs[i]) return -1;
+    }
+    return size;
+}
+
+// Lê o campo de informação de uma trama para packet, com até 'capacity' bytes de dados (ver readFrameInto)
+int readFrameData(LinkHandle *link, unsigned char *packet, int capacity, long long deadline) {
+    FrameData frame;
+    initFrameData(link, &frame, packet, capacity);
+    return readFrameInto(link, &frame, deadline);
+}
+
+// Envia uma trama não numerada (SET ou UA) com os parâmetros da ligação no campo de informação, protegidos pelo FCS
+// A trama fica guardada em parameterFrame, para poder ser reenviada por resendParameterFrame
+void sendParameterFrame(LinkHandle *link, char *title, unsigned char c, unsigned char *params, int paramsSize) {
+    unsigned char *frame = link->parameterFrame;
+    unsigned char fcs[FCS_MAX_SIZE];
+    int fcsSize = computeFcs(link, params, paramsSize, fcs);
+    int size = 0;
+    frame[size++] = FLAG;
+    frame[size++] = A;
+    frame[size++] = c;
+    frame[size++] = A ^ c;
+    size += stuff(link, params, paramsSize, frame + size);
+    size += stuff(link, fcs, fcsSize, frame + size);
+    frame[size++] = FLAG;
+    link->parameterFrameSize = size;
+    printLL(title, frame, size);  // DEBUG
+    link->totalTramas++;
+    link->totalTramasSU++;
+    write(link->fd, frame, size);
+}
+
+// Reenvia a última trama SET ou UA, tal como foi enviada (com os parâmetros protegidos pelo BCC2, e não pelo FCS negociado)
+void resendParameterFrame(LinkHandle *link, char *title) {
+    printLL(title, link->parameterFrame, link->parameterFrameSize);  // DEBUG
+    link->totalTramas++;
+    link->totalTramasSU++;
+    write(link->fd, link->parameterFrame, link->parameterFrameSize);
+}
+
+// Interpreta os parâmetros (TLV) recebidos numa trama SET ou UA, retirando o FCS, o tamanho máximo do campo de informação,
+// a paridade FEC máxima, a agregação e o full duplex propostos/aceites
+// Os parâmetros ausentes ou inválidos mantêm o valor recebido em fcs/maxInfo/fec/aggregate/duplex
+void parseParameters(unsigned char *params, int paramsSize, int *fcs, int *maxInfo, int *fec, int *aggregate, int *duplex) {
+    int index = 0;
+    while (index + 2 <= paramsSize && index + 2 + params[index + 1] <= paramsSize) {
+        unsigned char type = params[index];
+        unsigned char length = params[index + 1];
+        if (type == PARAM_FCS && length == 1) *fcs = params[index + 2];
+        if (type == PARAM_MAX_INFO && length == 2) {
+            int value = params[index + 2] * 256 + params[index + 3];
+            if (value > 0) *maxInfo = value < MAX_INFO_SIZE ? value : MAX_INFO_SIZE;
+        }
+        if (type == PARAM_FEC && length == 1) *fec = params[index + 2] < FEC_PARITY ? params[index + 2] : FEC_PARITY;
+        if (type == PARAM_AGGREGATE && length == 1) *aggregate = params[index + 2] != 0;
+        if (type == PARAM_DUPLEX && length == 1) *duplex = params[index + 2] != 0;
+        index += 2 + length;
     }
 }
 
 ////////////////////////////////////////////////
 // LLOPEN
 ////////////////////////////////////////////////
-int llopen(LinkLayer connectionParameters) {
-    totalOpen++;
-    start = clock();
-    fd = open(connectionParameters.serialPort, O_RDWR | O_NOCTTY);
-    if (fd < 0) {
+// Calcula as tabelas partilhadas por todas as ligações
+void initTables() {
+    crcInit();
+    fecInit();
+    stuffingInit();
+}
+
+// Abre a porta série e estabelece a ligação (SET/UA), negociando os parâmetros
+// Retorna 1 em caso de sucesso, -1 em caso de erro (a porta série fica aberta se link->fd >= 0)
+int openLink(LinkHandle *link, LinkLayer connectionParameters) {
+    link->totalOpen++;
+    link->start = monotonicMillis();
+    link->fd = open(connectionParameters.serialPort, O_RDWR | O_NOCTTY);
+    if (link->fd < 0) {
         printf("Erro a abrir a porta série %s\n", connectionParameters.serialPort);
         return -1;
     }
@@ -195,7 +948,7 @@ int llopen(LinkLayer connectionParameters) {
     struct termios oldtio;
     struct termios newtio;
 
-    if (tcgetattr(fd, &oldtio) == -1) {
+    if (tcgetattr(link->fd, &oldtio) == -1) {
         printf("Erro a usar tcgetattr\n");
         return -1;
     }
@@ -207,394 +960,1127 @@ int llopen(LinkLayer connectionParameters) {
     newtio.c_oflag = 0;
     newtio.c_lflag = 0;
     newtio.c_cc[VTIME] = 0;
-    newtio.c_cc[VMIN] = 0;
+    newtio.c_cc[VMIN] = 0;  // read() nunca bloqueia - a espera por bytes ou pelo fim de um prazo é feita com poll()
 
-    tcflush(fd, TCIOFLUSH);
+    tcflush(link->fd, TCIOFLUSH);
 
-    if (tcsetattr(fd, TCSANOW, &newtio) == -1) {
+    if (tcsetattr(link->fd, TCSANOW, &newtio) == -1) {
         printf("Erro a usar tcsetattr\n");
         return -1;
     }
 
-    nRetransmissions = connectionParameters.nRetransmissions;
-    timeout = connectionParameters.timeout;
-    role = connectionParameters.role;
+    link->nRetransmissions = connectionParameters.nRetransmissions;
+    link->timeout = connectionParameters.timeout;
+    link->rtoMax = link->timeout * 1000;
+    link->rto = link->rtoMax;  // até existir uma amostra do RTT, o RTO é o timeout configurado
+    link->role = connectionParameters.role;
+    link->fcsMode = FCS_XOR;  // os parâmetros do SET e do UA são protegidos pelo BCC2
+    link->maxInfoSize = MAX_INFO_SIZE;
+    link->fecMax = 0;  // as tramas SET e UA não têm FEC
+    link->fecParity = 0;
+    link->fecFrames = 0;
+    link->fecRetransmissions = 0;
+    link->fecQuietIntervals = 0;
 
     State state = START_STATE;
     unsigned char aCheck;
     unsigned char cCheck;
+    unsigned char params[MAX_PARAMS_SIZE];
+    int paramsSize = -1;
+    int proposedFcs = FCS_XOR;
+    int proposedMaxInfo = MAX_INFO_SIZE;  // um SET sem este parâmetro aceita tramas de tamanho MAX_PAYLOAD_SIZE
+    int proposedFec = 0;                  // um SET sem este parâmetro não usa FEC
+    int proposedAggregate = FALSE;        // nem agregação
+    int proposedDuplex = FALSE;           // nem full duplex
 
     if (connectionParameters.role == LlTx) {
-        (void)signal(SIGALRM, alarmHandler);
-        int tries = nRetransmissions;
-        unsigned char set[5] = {FLAG, A, C_SET, A ^ C_SET, FLAG};
+        int tries = link->nRetransmissions;
+        unsigned char set[] = {PARAM_FCS, 1, FCS_MODE, PARAM_MAX_INFO, 2, MAX_INFO_SIZE / 256, MAX_INFO_SIZE % 256, PARAM_FEC, 1, FEC_PARITY, PARAM_AGGREGATE, 1, AGGREGATE_MODE, PARAM_DUPLEX, 1, DUPLEX_MODE};
 
         do {
-            printLL("LLOPEN - enviado SET", set, sizeof(set));  // DEBUG
-            totalTramas++;
-            totalTramasSU++;
-            totalSET++;
-            write(fd, set, sizeof(set));
-            alarm(timeout);
-            alarmEnabled = TRUE;
-            while (alarmEnabled == TRUE && state != STOP_STATE) {
-                // Enquanto o alarme não tiver disparado e estado não for o final, processa os bytes da porta série (um de cada vez)
-                processByte(A, C_UA, C_UA, &aCheck, &cCheck, &state);  // espera um UA
+            link->totalSET++;
+            sendParameterFrame(link, "LLOPEN - enviado SET", C_SET, set, sizeof(set));
+            long long sentAt = monotonicMillis();
+            long long deadline = sentAt + link->rto;
+            paramsSize = -1;
+            while (paramsSize < 0) {
+                // Enquanto o prazo não tiver expirado e não for recebido um UA válido, processa os bytes da porta série (um de cada vez)
+                state = START_STATE;
+                while (state != BCC_OK_STATE) {
+                    if (processByte(link, A, C_UA, C_UA, C_MASK_EXACT, &aCheck, &cCheck, &state, deadline) <= 0) break;  // espera um UA
+                }
+                if (state != BCC_OK_STATE) break;
+                paramsSize = readFrameData(link, params, MAX_PARAMS_SIZE, deadline);
             }
-            if (state == STOP_STATE) {
-                // O estado final foi alcançado, pelo que o alarme pode ser desativado
-                alarm(0);
-                alarmEnabled = FALSE;
-            } else {
-                // O alarme tocou, pelo que ocorreu timeout e deve haver retransmissão (se ainda não tiver sido excedido o número máximo de tentativas)
+            if (paramsSize < 0) {
+                // O prazo expirou, pelo que ocorreu timeout e deve haver retransmissão (se ainda não tiver sido excedido o número máximo de tentativas)
+                timerExpired(link);
+                backoffRto(link);
                 tries--;
-                totalRetransmissions++;
+                link->totalRetransmissions++;
+            } else if (tries == link->nRetransmissions) {
+                // O UA respondeu ao primeiro SET, pelo que é a primeira amostra do RTT
+                updateRto(link, monotonicMillis() - sentAt);
             }
-        } while (tries >= 0 && state != STOP_STATE);
+        } while (tries >= 0 && paramsSize < 0 && !link->hungUp);
 
-        if (state != STOP_STATE) {
+        if (paramsSize < 0) {
             // Foi excedido o número máximo de tentativas de retransmissão
-            totalRetransmissions--;
+            link->totalRetransmissions--;
             printf("LLOPEN - UA não foi recebido\n");
             return -1;
         }
+
+        // O UA indica o FCS, o tamanho máximo do campo de informação, a paridade FEC máxima, a agregação e o full duplex aceites pelo recetor
+        int acceptedFcs = FCS_XOR;
+        int acceptedMaxInfo = MAX_INFO_SIZE;
+        int acceptedFec = 0;
+        int acceptedAggregate = FALSE;
+        int acceptedDuplex = FALSE;
+        parseParameters(params, paramsSize, &acceptedFcs, &acceptedMaxInfo, &acceptedFec, &acceptedAggregate, &acceptedDuplex);
+        link->fcsMode = acceptedFcs;
+        link->maxInfoSize = acceptedMaxInfo;
+        link->fecMax = acceptedFec;
+        link->aggregateAccepted = acceptedAggregate;
+        link->duplex = acceptedDuplex;
     } else if (connectionParameters.role == LlRx) {
-        while (state != STOP_STATE) {
+        while (paramsSize < 0) {
             // Processa os bytes da porta série (um de cada vez)
-            processByte(A, C_SET, C_SET, &aCheck, &cCheck, &state);  // espera um SET
+            state = START_STATE;
+            while (state != BCC_OK_STATE) {
+                if (processByte(link, A, C_SET, C_SET, C_MASK_EXACT, &aCheck, &cCheck, &state, NO_DEADLINE) < 0) return -1;  // espera um SET
+            }
+            paramsSize = readFrameData(link, params, MAX_PARAMS_SIZE, NO_DEADLINE);
         }
-        unsigned char ua[5] = {FLAG, A, C_UA, A ^ C_UA, FLAG};
-        printLL("LLOPEN - enviado UA", ua, sizeof(ua));  // DEBUG
-        totalTramas++;
-        totalTramasSU++;
-        totalUA++;
-        write(fd, ua, sizeof(ua));  // quando receber o SET, responde com UA
+
+        // Aceita o FCS proposto, a não ser que seja mais forte do que o do recetor,
+        // e o tamanho máximo do campo de informação e a paridade FEC propostos, limitados a MAX_INFO_SIZE e FEC_PARITY (em parseParameters)
+        // A agregação e o full duplex só são aceites se os dois lados os propuserem
+        parseParameters(params, paramsSize, &proposedFcs, &proposedMaxInfo, &proposedFec, &proposedAggregate, &proposedDuplex);
+        int acceptedFcs = proposedFcs < FCS_MODE ? proposedFcs : FCS_MODE;
+        int acceptedAggregate = proposedAggregate && AGGREGATE_MODE;
+        int acceptedDuplex = proposedDuplex && DUPLEX_MODE;
+        unsigned char ua[] = {PARAM_FCS, 1, acceptedFcs, PARAM_MAX_INFO, 2, proposedMaxInfo / 256, proposedMaxInfo % 256, PARAM_FEC, 1, proposedFec, PARAM_AGGREGATE, 1, acceptedAggregate, PARAM_DUPLEX, 1, acceptedDuplex};
+        link->totalUA++;
+        sendParameterFrame(link, "LLOPEN - enviado UA", C_UA, ua, sizeof(ua));  // quando receber o SET, responde com UA
+        link->fcsMode = acceptedFcs;
+        link->maxInfoSize = proposedMaxInfo;
+        link->fecMax = proposedFec;
+        link->aggregateAccepted = acceptedAggregate;
+        link->duplex = acceptedDuplex;
     } else {
         printf("Erro em connectionParameters.role\n");
         return -1;
     }
+    link->aggregation = link->aggregateAccepted;
+
+    return 1;
+}
+
+LinkHandle *linkOpen(LinkLayer connectionParameters) {
+    pthread_once(&tablesOnce, initTables);
+    LinkHandle *link = calloc(1, sizeof(LinkHandle));
+    if (link == NULL) return NULL;
+    link->fd = -1;
+    link->cancelState = PTHREAD_CANCEL_DISABLE;
+    // Os prazos de waitChanged usam o relógio monotónico, como os restantes
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&link->changed, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&link->lock, NULL);
+    pthread_mutex_lock(&link->lock);
+    int result = openLink(link, connectionParameters);
+    pthread_mutex_unlock(&link->lock);
+    if (result < 0) {
+        if (link->fd >= 0) close(link->fd);
+        pthread_mutex_destroy(&link->lock);
+        pthread_cond_destroy(&link->changed);
+        free(link);
+        return NULL;
+    }
+    return link;
+}
+
+////////////////////////////////////////////////
+// RECEÇÃO DE TRAMAS (LLWRITE E LLREAD)
+////////////////////////////////////////////////
+
+// Liberta as tramas confirmadas por N(r) = r, isto é, todas as tramas anteriores a r (confirmação cumulativa)
+// A trama mais recente confirmada fornece uma amostra do RTT, se não tiver sido retransmitida
+// Retorna o número de tramas confirmadas
+int acknowledge(LinkHandle *link, unsigned char r) {
+    int acked = (r - link->base + SEQ_MODULUS) % SEQ_MODULUS;
+    if (acked > link->outstanding) return 0;  // N(r) fora da janela - confirmação antiga
+    if (acked > 0) {
+        unsigned char newest = (r - 1 + SEQ_MODULUS) % SEQ_MODULUS;
+        if (link->windowRetransmitted[newest] == FALSE) updateRto(link, monotonicMillis() - link->windowSentAt[newest]);
+    }
+    link->base = (link->base + acked) % SEQ_MODULUS;
+    link->outstanding -= acked;
+    if (acked > 0) pthread_cond_broadcast(&link->changed);  // a outra thread pode estar à espera de espaço na janela
+    return acked;
+}
+
+// Avança a janela do recetor depois de entregar a trama esperada
+// A confirmação é adiada até existirem ACK_EVERY tramas por confirmar, que são confirmadas com um único RR cumulativo
+// Em full duplex, enquanto esta ponta está a enviar tramas I (e tem espaço na janela), a confirmação segue na próxima delas;
+// só com a janela do outro lado esgotada ou quando expira ACK_DELAY é enviado um RR
+void acceptExpected(LinkHandle *link) {
+    link->expectedSeq = (link->expectedSeq + 1) % SEQ_MODULUS;
+    link->rejSent = FALSE;
+    if (link->ackPending++ == 0) link->ackDeadline = monotonicMillis() + ACK_DELAY;
+    if (link->quickAcks > 0) link->quickAcks--;
+    int sending = link->duplex && link->outstanding > 0 && link->outstanding < WINDOW_SIZE;
+    if (link->ackPending >= (sending ? WINDOW_SIZE : ACK_EVERY) || link->quickAcks > 0) acknowledgePending(link, "LLREAD - RR enviado");
+}
+
+// Pede a retransmissão da trama danificada logo que termina uma trama com o cabeçalho danificado, em vez de deixar o emissor
+// esperar pelo timeout
+// Go-Back-N: é pedida a retransmissão a partir da trama esperada
+// Selective Repeat: a trama danificada é a primeira das tramas em falta até nextArrival que ainda não foi pedida
+// Cada trama é pedida uma única vez (rejSent/srejSent), pelo que uma rajada de erros não provoca retransmissões repetidas
+void rejectDamaged(LinkHandle *link) {
+#if ARQ_MODE == ARQ_SELECTIVE_REPEAT
+    unsigned char seq = link->expectedSeq;
+    int span = (link->nextArrival - link->expectedSeq + SEQ_MODULUS) % SEQ_MODULUS;
+    for (int i = 0; i <= span && i < WINDOW_SIZE; i++) {
+        if (!link->reorderReceived[seq] && !link->srejSent[seq]) {
+            link->srejSent[seq] = TRUE;
+            acknowledgePending(link, "LLREAD - RR enviado");
+            sendSupervisionFrame(link, "LLREAD - SREJ enviado (cabeçalho danificado)", C_SREJ(seq));
+            return;
+        }
+        seq = (seq + 1) % SEQ_MODULUS;
+    }
+#else
+    if (link->rejSent) return;
+    link->rejSent = TRUE;
+    sendSupervisionFrame(link, "LLREAD - REJ enviado (cabeçalho danificado)", C_REJ(link->expectedSeq));
+#endif
+}
+
+// Entrega um pacote guardado na ligação (buffer de reordenação ou trama agregada): os dados a seguir aos primeiros headerSize bytes
+// são copiados para o destino escolhido por place, se lá couberem, e os restantes para packet
+void deliverStored(const unsigned char *buffer, int size, unsigned char *packet, int headerSize, LinkPlacement place, void *context, int *placed) {
+    int capacity = 0;
+    unsigned char *data = place != NULL && size > headerSize ? place(context, buffer, headerSize, &capacity) : NULL;
+    if (data != NULL && capacity >= size - headerSize) {
+        memcpy(packet, buffer, headerSize);
+        memcpy(data, buffer + headerSize, size - headerSize);
+        *placed = TRUE;
+    } else {
+        memcpy(packet, buffer, size);
+    }
+}
+
+// Guarda em unpackBuffer o campo de informação de uma trama agregada, para os seus pacotes serem entregues um a um
+// Retorna 1 em caso de sucesso, -1 se os tamanhos dos pacotes não corresponderem ao tamanho da trama
+int storeAggregate(LinkHandle *link, const unsigned char *data, int size) {
+    int position = 0;
+    while (position + AGGREGATE_PREFIX <= size) position += AGGREGATE_PREFIX + data[position] * 256 + data[position + 1];
+    if (size == 0 || position != size) {
+        printf("LLREAD - trama agregada inválida\n");
+        return -1;
+    }
+    if (data != link->unpackBuffer) memcpy(link->unpackBuffer, data, size);
+    link->unpackSize = size;
+    link->unpackHead = 0;
+    return 1;
+}
+
+// Entrega o próximo pacote da trama agregada guardada em unpackBuffer (ver deliverStored)
+// Retorna o número de bytes do pacote
+int deliverUnpacked(LinkHandle *link, unsigned char *packet, int headerSize, LinkPlacement place, void *context, int *placed) {
+    unsigned char *sub = link->unpackBuffer + link->unpackHead;
+    int size = sub[0] * 256 + sub[1];
+    link->unpackHead += AGGREGATE_PREFIX + size;
+    deliverStored(sub + AGGREGATE_PREFIX, size, packet, headerSize, place, context, placed);
+    return size;
+}
 
+// Lê o campo de informação da trama seq para o buffer de reordenação, onde fica até ser entregue por llread
+// Retorna 1 em caso de sucesso, -1 se o FCS estiver incorreto (é pedida a retransmissão da trama)
+int storeFrame(LinkHandle *link, unsigned char seq, unsigned char c) {
+    int size = readFrameData(link, link->reorderBuffer[seq], link->maxInfoSize, NO_DEADLINE);
+    if (size < 0 && link->hungUp) return -1;
+    if (size < 0) {
+        link->totalBCC2++;
+        link->quickAcks = ACK_QUICK;
+#if ARQ_MODE == ARQ_SELECTIVE_REPEAT
+        link->srejSent[seq] = TRUE;
+        acknowledgePending(link, "LLREAD - RR enviado");
+        sendSupervisionFrame(link, "LLREAD - SREJ enviado", C_SREJ(seq));
+#else
+        link->rejSent = TRUE;
+        sendSupervisionFrame(link, "LLREAD - REJ enviado", C_REJ(link->expectedSeq));
+#endif
+        return -1;
+    }
+    link->reorderSizes[seq] = size;
+    link->reorderAggregated[seq] = (c & C_AGGREGATE) != 0;
+    link->reorderReceived[seq] = TRUE;
+    link->srejSent[seq] = FALSE;
+    pthread_cond_broadcast(&link->changed);  // a thread de llread pode estar à espera desta trama
     return 1;
 }
 
+/**
+ * Recebe o campo de informação de uma trama I, cujo cabeçalho (campo C 'c') acabou de ser lido
+ * @param packet buffer onde são colocados os dados da trama esperada, ou NULL se a trama chegou durante llwrite ou llflush
+ * @param headerSize, place, context, placed ver linkReadPlaced
+ * @return número de bytes de dados entregues em packet, ou -1 se nada foi entregue (trama guardada, duplicada ou com erros)
+ *
+ * @details
+ * Em full duplex, o N(r) da trama confirma primeiro as tramas enviadas no outro sentido.
+ * Sem packet, a trama esperada fica no buffer de reordenação, como uma trama fora de ordem, e só é aceite (e confirmada)
+ * quando llread a entrega, pelo que o outro lado não envia mais do que a aplicação lê
+ */
+int receiveInformation(LinkHandle *link, unsigned char c, unsigned char *packet, int headerSize, LinkPlacement place, void *context, int *placed) {
+    if (link->duplex) acknowledge(link, PIGGYBACK_NR(c));
+
+    unsigned char seq = NS(c);
+    int distance = (seq - link->expectedSeq + SEQ_MODULUS) % SEQ_MODULUS;
+    if (distance < WINDOW_SIZE && distance >= (link->nextArrival - link->expectedSeq + SEQ_MODULUS) % SEQ_MODULUS) link->nextArrival = (seq + 1) % SEQ_MODULUS;
+
+    if (distance == 0 && packet != NULL) {
+        // Recebeu a trama de que estava à espera (os pacotes de uma trama agregada ficam em unpackBuffer e são entregues um a um)
+        int aggregated = c & C_AGGREGATE;
+        FrameData frame;
+        initFrameData(link, &frame, aggregated ? link->unpackBuffer : packet, link->maxInfoSize);
+        if (!aggregated && place != NULL && headerSize < link->maxInfoSize) {
+            frame.split = headerSize;
+            frame.dataEnd = headerSize;
+            frame.place = place;
+            frame.context = context;
+        }
+        int size = readFrameInto(link, &frame, NO_DEADLINE);
+        *placed = size >= 0 && frame.placed;
+        if (size < 0 && link->hungUp) return -1;
+        if (size >= 0) {
+            // O valor de BCC2 está correto, pelo que a trama foi recebida com sucesso e o recetor está pronto para a próxima
+            link->srejSent[seq] = FALSE;
+            acceptExpected(link);
+            if (aggregated) return storeAggregate(link, link->unpackBuffer, size) < 0 ? -1 : deliverUnpacked(link, packet, headerSize, place, context, placed);
+            return size;
+        }
+        // O valor de BCC2 está incorreto, pelo que a trama deve ser retransmitida
+        link->totalBCC2++;
+        link->quickAcks = ACK_QUICK;
+#if ARQ_MODE == ARQ_SELECTIVE_REPEAT
+        link->srejSent[seq] = TRUE;
+        acknowledgePending(link, "LLREAD - RR enviado");
+        sendSupervisionFrame(link, "LLREAD - SREJ enviado", C_SREJ(seq));
+#else
+        link->rejSent = TRUE;
+        sendSupervisionFrame(link, "LLREAD - REJ enviado", C_REJ(link->expectedSeq));
+#endif
+        return -1;
+    }
+
+    if (distance >= WINDOW_SIZE) {
+        // Trama duplicada: responde com a indicação de qual é o índice da trama que está pronto para receber
+        link->totalDuplicados++;
+        link->quickAcks = ACK_QUICK;
+        discardFrame(link);
+        sendSupervisionFrame(link, "LLREAD - RR enviado", C_RR(link->expectedSeq));
+        return -1;
+    }
+
+    if (link->reorderReceived[seq]) {
+        // Já estava guardada no buffer de reordenação
+        discardFrame(link);
+        return -1;
+    }
+    if (distance == 0) {
+        // Trama esperada recebida enquanto esta thread escreve: fica guardada para llread
+        storeFrame(link, seq, c);
+        return -1;
+    }
+
+    // Recebeu uma trama posterior à esperada: se alguma das anteriores ainda não foi recebida (e não está apenas à espera de
+    // ser entregue por llread), houve pelo menos uma trama que se perdeu
+    int lost = FALSE;
+    for (unsigned char missing = link->expectedSeq; missing != seq; missing = (missing + 1) % SEQ_MODULUS) {
+        if (!link->reorderReceived[missing]) lost = TRUE;
+    }
+    if (lost) {
+        link->totalForaDeOrdem++;
+        link->quickAcks = ACK_QUICK;
+    }
+#if ARQ_MODE == ARQ_SELECTIVE_REPEAT
+    if (lost) acknowledgePending(link, "LLREAD - RR enviado");
+    if (storeFrame(link, seq, c) < 0) return -1;
+    // Pede apenas as tramas em falta que antecedem a trama guardada
+    for (unsigned char missing = link->expectedSeq; missing != seq; missing = (missing + 1) % SEQ_MODULUS) {
+        if (!link->reorderReceived[missing] && !link->srejSent[missing]) {
+            link->srejSent[missing] = TRUE;
+            sendSupervisionFrame(link, "LLREAD - SREJ enviado", C_SREJ(missing));
+        }
+    }
+#else
+    if (!lost) {
+        // As tramas anteriores só esperam por llread, pelo que esta também fica guardada
+        storeFrame(link, seq, c);
+        return -1;
+    }
+    // Go-Back-N: é pedida a retransmissão a partir da trama esperada (apenas uma vez)
+    discardFrame(link);
+    if (link->rejSent == FALSE) {
+        link->rejSent = TRUE;
+        sendSupervisionFrame(link, "LLREAD - REJ enviado", C_REJ(link->expectedSeq));
+    }
+#endif
+    return -1;
+}
+
 ////////////////////////////////////////////////
 // LLWRITE
 ////////////////////////////////////////////////
-int llwrite(const unsigned char *buf, int bufSize) {
-    totalWrite++;
-    unsigned char bcc2 = buf[0];
-    for (int i = 1; i < bufSize; i++) {
-        // Cálculo do BCC2
-        bcc2 ^= buf[i];
+
+// Calcula a paridade FEC da mensagem formada pelos 'size' bytes de dados e pelo FCS, em blocos de FEC_BLOCK_SIZE - nsym bytes
+// Retorna o número de bytes de paridade escritos em parity
+int encodeParity(const unsigned char *data, int size, const unsigned char *fcs, int fcsSize, int nsym, unsigned char *parity) {
+    int blockSize = FEC_BLOCK_SIZE - nsym;
+    int messageSize = size + fcsSize;
+    int blocks = fecBlocks(messageSize, nsym);
+    memset(parity, 0, blocks * nsym);
+    for (int b = 0; b < blocks; b++) {
+        int begin = b * blockSize;
+        int end = begin + blockSize < messageSize ? begin + blockSize : messageSize;
+        // O último bloco pode incluir o fim dos dados e o FCS
+        if (begin < size) rsEncodeUpdate(parity + b * nsym, nsym, data + begin, (end < size ? end : size) - begin);
+        if (end > size) {
+            int fcsBegin = begin > size ? begin - size : 0;
+            rsEncodeUpdate(parity + b * nsym, nsym, fcs + fcsBegin, end - size - fcsBegin);
+        }
     }
+    return blocks * nsym;
+}
 
-    unsigned char *dataBcc2 = (unsigned char *)malloc(2 * bufSize + 2);  // aloca memória dinâmica para o pior caso: ter de fazer stuffing de todos os bytes de dados e do BCC2
+/**
+ * Codifica o campo de informação de uma trama I (dados e FCS, com stuffing) numa única passagem pelos dados
+ * @param data dados a enviar
+ * @param size número de bytes de dados (no máximo maxInfoSize)
+ * @param body buffer para os dados após o stuffing, com MAX_STUFFED_SIZE bytes
+ * @param trailer buffer para o FCS e o FEC após o stuffing e o FLAG final, com MAX_TRAILER_SIZE bytes
+ * @param trailerSize número de bytes escritos em trailer
+ * @return número de bytes escritos em body
+ *
+ * @details
+ * Cada sequência de bytes sem FLAG nem ESC é copiada de uma vez e entra no FCS enquanto ainda está na cache,
+ * pelo que os dados não são percorridos uma segunda vez nem copiados para buffers intermédios (exceto pelo FEC, se usado)
+ */
+int encodeInformation(LinkHandle *link, const unsigned char *data, int size, unsigned char *body, unsigned char *trailer, int *trailerSize) {
+    const unsigned char *message = data;
+    unsigned int reg = fcsInitial(link);
     int index = 0;
-    for (int i = 0; i < bufSize; i++) {
-        // Stuffing dos dados
-        if (buf[i] == FLAG) {
-            totalStuffed++;
-            totalFlagStuffed++;
-            dataBcc2[index++] = ESC;
-            dataBcc2[index++] = FLAG_ESCAPED;
-        } else if (buf[i] == ESC) {
-            totalStuffed++;
-            totalEscStuffed++;
-            dataBcc2[index++] = ESC;
-            dataBcc2[index++] = ESC_ESCAPED;
-        } else {
-            dataBcc2[index++] = buf[i];
+    int remaining = size;
+    while (remaining > 0) {
+        int run = findSpecial(data, remaining);
+        int special = run < remaining;  // a sequência termina num FLAG ou ESC
+        reg = updateFcs(link, reg, data, run + special);
+        memcpy(body + index, data, run);
+        index += run;
+        if (special) {
+            // Stuffing do FLAG ou ESC
+            unsigned char byte = data[run];
+            link->totalFlagStuffed += (byte == FLAG);
+            link->totalEscStuffed += (byte == ESC);
+            body[index++] = ESC;
+            body[index++] = byte == FLAG ? FLAG_ESCAPED : ESC_ESCAPED;
         }
+        data += run + special;
+        remaining -= run + special;
     }
+    link->totalStuffed += index - size;
 
-    // Stuffing do BCC2
-    if (bcc2 == FLAG) {
-        totalStuffed++;
-        totalFlagStuffed++;
-        dataBcc2[index++] = ESC;
-        dataBcc2[index++] = FLAG_ESCAPED;
-    } else if (bcc2 == ESC) {
-        totalStuffed++;
-        totalEscStuffed++;
-        dataBcc2[index++] = ESC;
-        dataBcc2[index++] = ESC_ESCAPED;
-    } else {
-        dataBcc2[index++] = bcc2;
+    unsigned char check[FCS_MAX_SIZE + FEC_MAX_SIZE];  // FCS, paridade FEC e indicação da paridade
+    int checkSize = finishFcs(link, reg, check);
+    if (link->fecMax > 0) {
+        if (link->fecParity > 0) checkSize += encodeParity(message, size, check, checkSize, link->fecParity, check + checkSize);
+        check[checkSize++] = link->fecParity;
+    }
+    *trailerSize = stuff(link, check, checkSize, trailer);  // Stuffing do FCS e do FEC
+    trailer[(*trailerSize)++] = FLAG;
+    return index;
+}
+
+// Envia (ou reenvia) a trama I guardada na janela com número de sequência seq e reinicia o seu temporizador
+// O cabeçalho, os dados e o fim da trama são escritos de uma vez com writev()
+// Em full duplex, o N(r) do cabeçalho é atualizado em cada envio, pelo que a trama confirma todas as tramas aceites até agora
+// O cabeçalho não é stuffed: se o campo C ficasse igual a FLAG (N(s) = N(r) = 7), segue o N(r) anterior, que confirma
+// uma trama a menos, e a última trama aceite continua por confirmar (ver DUPLEX_MODE)
+void sendWindowFrame(LinkHandle *link, unsigned char seq) {
+    if (link->duplex) {
+        unsigned char *header = link->windowHeaders[seq];
+        unsigned char r = link->expectedSeq;
+        if (((header[2] & ~C_PIGGYBACK_MASK) | C_PIGGYBACK(r)) == FLAG) r = (r - 1 + SEQ_MODULUS) % SEQ_MODULUS;
+        header[2] = (header[2] & ~C_PIGGYBACK_MASK) | C_PIGGYBACK(r);
+        header[3] = A ^ header[2];  // BCC1
+        if (r == link->expectedSeq) {
+            if (link->ackPending > 0) link->totalPiggyback++;
+            link->ackPending = 0;
+        }
     }
+    printLL("LLWRITE - frame enviado (cabeçalho)", link->windowHeaders[seq], HEADER_SIZE);           // DEBUG
+    printLL("LLWRITE - frame enviado (dados)", link->windowBodies[seq], link->windowBodySizes[seq]);        // DEBUG
+    printLL("LLWRITE - frame enviado (FCS e FLAG)", link->windowTrailers[seq], link->windowTrailerSizes[seq]);  // DEBUG
+    link->totalTramas++;
+    link->totalTramasI++;
+    struct iovec frame[3] = {
+        {link->windowHeaders[seq], HEADER_SIZE},
+        {link->windowBodies[seq], link->windowBodySizes[seq]},
+        {link->windowTrailers[seq], link->windowTrailerSizes[seq]},
+    };
+    writev(link->fd, frame, 3);
+    link->windowSentAt[seq] = monotonicMillis();
+    link->windowDeadlines[seq] = link->windowSentAt[seq] + link->rto;
+}
+
+// Pede ao recetor a confirmação imediata das tramas por confirmar (RR com C_POLL), uma vez por cada conjunto de tramas enviadas
+void pollReceiver(LinkHandle *link) {
+    if (link->outstanding == 0 || link->polled) return;
+    link->polled = TRUE;
+    sendSupervisionFrame(link, "LLWRITE - RR (poll) enviado", C_RR(link->nextSeq) | C_POLL);
+}
+
+// Retransmite a trama com número de sequência seq
+void resendWindowFrame(LinkHandle *link, unsigned char seq) {
+    link->totalRetransmissions++;
+    link->windowRetransmitted[seq] = TRUE;
+    sendWindowFrame(link, seq);
+}
 
-    static unsigned char tramaI = 0;
-    unsigned char n = N(tramaI);
-    unsigned char bcc1 = A ^ n;
+// Go-Back-N: retransmite todas as tramas por confirmar, a começar na mais antiga
+void resendWindow(LinkHandle *link) {
+    unsigned char seq = link->base;
+    for (int i = 0; i < link->outstanding; i++) {
+        resendWindowFrame(link, seq);
+        seq = (seq + 1) % SEQ_MODULUS;
+    }
+}
 
-    unsigned char next = (tramaI + 1) % 2;
+// Retransmissão rápida: retransmite a trama mais antiga por confirmar sem esperar pelo seu temporizador
+// Só é feita se a trama ainda não tiver sido retransmitida, pelo que cada trama custa no máximo uma retransmissão extra
+void fastRetransmit(LinkHandle *link) {
+    if (link->outstanding == 0 || link->windowRetransmitted[link->base]) return;
+    link->totalRetransmissoesRapidas++;
+#if ARQ_MODE == ARQ_SELECTIVE_REPEAT
+    resendWindowFrame(link, link->base);
+#else
+    resendWindow(link);
+#endif
+}
 
-    // Construção do frame a transmitir
-    unsigned char *frame = malloc(index + 5);  // 5 -> F A C BCC1 F;
-    frame[0] = FLAG;
-    frame[1] = A;
-    frame[2] = n;
-    frame[3] = bcc1;
-    for (int i = 4; i < (index + 4); i++) {
-        frame[i] = dataBcc2[i - 4];
+// Retorna o fim do prazo mais próximo de entre as tramas por confirmar
+long long nextDeadline(LinkHandle *link) {
+    long long deadline = link->windowDeadlines[link->base];
+    unsigned char seq = link->base;
+    for (int i = 0; i < link->outstanding; i++) {
+        if (link->windowDeadlines[seq] < deadline) deadline = link->windowDeadlines[seq];
+        seq = (seq + 1) % SEQ_MODULUS;
     }
-    frame[index + 4] = FLAG;
+    return deadline;
+}
 
-    int size = index + 5;  // 5 -> F A C BCC1 F
+// Retransmite as tramas cujo temporizador expirou
+// Go-Back-N: se expirou o temporizador da trama mais antiga, retransmite toda a janela
+// Selective Repeat: retransmite apenas as tramas cujo temporizador expirou
+// Retorna 1 em caso de sucesso, -1 se foi excedido o número máximo de tentativas de uma trama
+int handleTimeouts(LinkHandle *link) {
+    long long now = monotonicMillis();
+    timerExpired(link);
+    backoffRto(link);
+#if ARQ_MODE == ARQ_SELECTIVE_REPEAT
+    unsigned char seq = link->base;
+    for (int i = 0; i < link->outstanding; i++) {
+        if (link->windowDeadlines[seq] <= now) {
+            if (link->windowTries[seq] == 0) return -1;
+            link->windowTries[seq]--;
+            resendWindowFrame(link, seq);
+        }
+        seq = (seq + 1) % SEQ_MODULUS;
+    }
+#else
+    if (link->windowDeadlines[link->base] <= now) {
+        if (link->windowTries[link->base] == 0) return -1;
+        link->windowTries[link->base]--;
+        resendWindow(link);
+    }
+#endif
+    return 1;
+}
 
+// Trata uma trama recebida que não é uma trama I (campo C 'c'): as respostas (RR, REJ e SREJ) às tramas enviadas atualizam a janela;
+// um RR com C_POLL é respondido de imediato com um RR; um SET repetido significa que o UA se perdeu, pelo que o UA é reenviado;
+// as restantes são ignoradas
+// Retorna TRUE se a janela avançou ou foi retransmitida a partir da trama rejeitada
+int handleResponse(LinkHandle *link, unsigned char c) {
+    if ((c & C_MASK_S) != C_S) {
+        if (c == C_SET) {
+            link->totalUA++;
+            resendParameterFrame(link, "Reenviado UA");
+        }
+        return FALSE;
+    }
+    if (c & C_POLL) {
+        // Pedido de confirmação do outro lado, que não é uma resposta às tramas enviadas
+        sendSupervisionFrame(link, "RR enviado (poll)", C_RR(link->expectedSeq));
+        return FALSE;
+    }
+
+    // Interpretação da Resposta
+    unsigned char r = NR(c);
+    int inWindow = (r - link->base + SEQ_MODULUS) % SEQ_MODULUS < link->outstanding;
+    if (C_TYPE(c) == C_TYPE_RR) {
+        // Confirmação cumulativa - o recetor está pronto para receber a trama r
+        return acknowledge(link, r) > 0;
+    }
+    if (C_TYPE(c) == C_TYPE_REJ && inWindow) {
+        link->totalRejeitadas++;
+        // A trama r foi rejeitada - as anteriores foram recebidas e a partir de r são todas retransmitidas
+        acknowledge(link, r);
+        resendWindow(link);
+        return TRUE;
+    }
+    if (C_TYPE(c) == C_TYPE_SREJ && inWindow) {
+        link->totalRejeitadas++;
+        // Apenas a trama r foi rejeitada ou perdeu-se - só ela é retransmitida
+        resendWindowFrame(link, r);
+    }
+    return FALSE;
+}
+
+/**
+ * Processa as respostas do recetor (RR, REJ e SREJ) até existirem no máximo 'limit' tramas por confirmar
+ * @param limit número máximo de tramas por confirmar à saída
+ * @return 1 em caso de sucesso, -1 se foi excedido o número máximo de tentativas de retransmissão
+ *
+ * @details
+ * Espera com poll() até chegarem bytes ou até ao fim do prazo mais próximo das tramas por confirmar.
+ * Os bytes já disponíveis na porta série são sempre processados antes de considerar que ocorreu timeout,
+ * pelo que uma confirmação que chegou enquanto o emissor enviava outras tramas não provoca retransmissões.
+ * Uma resposta com o cabeçalho danificado pode ter sido um REJ/SREJ ou o RR de que o emissor está à espera; se, quando já
+ * devia ter chegado a resposta à trama enviada mais recentemente (um RTT depois do seu envio), nenhum RR tiver avançado a janela,
+ * a trama mais antiga é retransmitida (fastRetransmit) sem esperar pelo seu RTO - se o recetor já a tinha, responde com um RR
+ * que liberta a janela.
+ * Como o recetor adia as confirmações (ver ACK_EVERY), o emissor pede-as de imediato (pollReceiver) quando tem de esperar
+ * pela confirmação de todas as tramas (limit == 0) e quando recebe uma resposta danificada, que pode ter sido o RR que esperava.
+ * As tramas I do outro sentido ficam guardadas para llread (ver receiveInformation). Em full duplex, se a thread de llread
+ * estiver a ler da porta série, é ela que trata as respostas, e esta só espera que a janela avance ou que expire um prazo
+ */
+int processAcks(LinkHandle *link, int limit) {
     State state = START_STATE;
     unsigned char aCheck;
     unsigned char cCheck;
-    unsigned char accepetedCheck;
-    unsigned char rejectedCheck;
+    int damaged = FALSE;  // chegou uma resposta com o cabeçalho danificado e a janela não avançou desde então
+    long long fastDeadline = 0;  // instante da retransmissão rápida, se a resposta danificada não for compensada por um RR
+    int reader = FALSE;  // esta thread está a ler da porta série (ver reading)
+    int result = 1;
 
-    int tries = nRetransmissions;
+    if (limit == 0) pollReceiver(link);
 
-    do {
-        printLL("LL WRITE - frame enviado", frame, size);  // DEBUG
-        totalTramas++;
-        totalTramasI++;
-        write(fd, frame, size);
-        alarm(timeout);
-        alarmEnabled = TRUE;
-        accepetedCheck = FALSE;
-        rejectedCheck = FALSE;
-        while (alarmEnabled == TRUE && rejectedCheck == FALSE && accepetedCheck == FALSE) {
-            state = START_STATE;
-            while (state != STOP_STATE && alarmEnabled == TRUE) {
-                // Enquanto o alarme não tiver disparado e estado não for o final, processa os bytes da porta série (um de cada vez)
-                processByte(A, C_RR(next), C_REJ(tramaI), &aCheck, &cCheck, &state);  // espera um RR ou REJ
+    while (link->outstanding > limit) {
+        State previous = state;
+        long long deadline = nextDeadline(link);
+        if (damaged && fastDeadline < deadline) deadline = fastDeadline;
+        if (!reader && link->reading) {
+            if (waitChanged(link, deadline) == 0 && handleTimeouts(link) < 0) {
+                result = -1;
+                break;
             }
-
-            if (state == STOP_STATE) {
-                // O estado final foi alcançado, pelo que o alarme pode ser desativado
-                alarm(0);
-                alarmEnabled = FALSE;
-            } else {
-                // O alarme tocou, pelo que ocorreu timeout e deve haver retransmissão (se ainda não tiver sido excedido o número máximo de tentativas)
-                tries--;
-                totalRetransmissions++;
+            continue;
+        }
+        link->reading = reader = TRUE;
+        int ready = processByte(link, A, C_I, C_S, C_MASK_I, &aCheck, &cCheck, &state, deadline);  // espera uma resposta ou uma trama I
+        if (ready < 0) {
+            result = -1;
+            break;
+        }
+        if (ready == 0) {
+            if (damaged && monotonicMillis() >= fastDeadline) {
+                damaged = FALSE;
+                fastRetransmit(link);
                 continue;
             }
-
-            // Interpretação da Resposta
-            if (cCheck == C_RR(next)) {
-                // O frame enviado foi recebido e aceite - o recetor está pronto para receber o próximo frame
-                accepetedCheck = TRUE;
-                tramaI = next;
-            } else if (cCheck == C_REJ(tramaI)) {
-                // O frame enviado foi rejeitado - deve ser retransmitido (se ainda não tiver sido excedido o número máximo de tentativas)
-                rejectedCheck = TRUE;
+            if (handleTimeouts(link) < 0) {
+                // O prazo expirou e foi excedido o número máximo de tentativas de retransmissão
+                result = -1;
+                break;
             }
+            continue;
+        }
+        if (headerDamaged(previous, state)) {
+            link->totalDanificadas++;
+            damaged = TRUE;
+            fastDeadline = link->windowSentAt[(link->nextSeq - 1 + SEQ_MODULUS) % SEQ_MODULUS] + link->srtt + link->rttvar;
+            pollReceiver(link);
         }
-    } while (tries >= 0 && accepetedCheck == FALSE);
+        if (state == BCC_OK_STATE && (cCheck & C_MASK_I) == C_I) {
+            // Trama I do sentido oposto: em full duplex, ou retransmitida depois de uma inversão com llflush porque a sua confirmação se perdeu
+            receiveInformation(link, cCheck, NULL, 0, NULL, NULL, NULL);
+            state = START_STATE;
+            continue;
+        }
+        if (state != STOP_STATE) continue;
+        state = START_STATE;
+        if (handleResponse(link, cCheck)) damaged = FALSE;
+    }
+    if (reader) releaseReading(link);
+    if (result < 0) printf("LLWRITE - não foi recebida resposta\n");
+    return result;
+}
 
-    if (state != STOP_STATE) {
-        // Foi excedido o número máximo de tentativas de retransmissão
-        totalRetransmissions--;
-        printf("LLWRITE - não foi recebida resposta\n");
-        return -1;
+/**
+ * Ajusta a paridade FEC das próximas tramas I à fração de tramas retransmitidas desde o último ajuste
+ *
+ * @details
+ * Com mais de FEC_RAISE_RATE% de tramas retransmitidas a paridade duplica (até à negociada); só depois de
+ * FEC_QUIET_INTERVALS intervalos seguidos sem retransmissões passa para metade, pelo que numa ligação com erros
+ * não oscila a cada intervalo
+ */
+void adaptFec(LinkHandle *link) {
+    if (link->fecMax == 0 || ++link->fecFrames < FEC_ADAPT_INTERVAL) return;
+    int retransmissions = link->totalRetransmissions - link->fecRetransmissions;
+    int parity = link->fecParity;
+    link->fecFrames = 0;
+    link->fecRetransmissions = link->totalRetransmissions;
+    if (100 * retransmissions > FEC_RAISE_RATE * FEC_ADAPT_INTERVAL) {
+        parity = parity == 0 ? FEC_MIN_PARITY : 2 * parity;
+        if (parity > link->fecMax) parity = link->fecMax;
+        link->fecQuietIntervals = 0;
+    } else if (retransmissions > 0) {
+        link->fecQuietIntervals = 0;
+    } else if (++link->fecQuietIntervals == FEC_QUIET_INTERVALS) {
+        parity = parity / 2 < FEC_MIN_PARITY ? 0 : parity / 2;
+        link->fecQuietIntervals = 0;
     }
+    if (parity != link->fecParity) printf("Paridade FEC: %d bytes por bloco\n", parity);  // DEBUG
+    link->fecParity = parity;
+}
+
+// Envia uma trama I com os dados de buf e os bits 'flags' no campo C (C_AGGREGATE ou 0)
+// Se a janela estiver cheia, espera primeiro que seja confirmada pelo menos uma trama
+// Retorna o número de bytes da trama, ou -1 se foi excedido o número máximo de tentativas de retransmissão
+int sendInformationFrame(LinkHandle *link, const unsigned char *buf, int bufSize, unsigned char flags) {
+    // As tramas recebidas antes da inversão não esperam por ACK_DELAY; em full duplex, são confirmadas por esta trama
+    // (ver sendWindowFrame), a não ser que a janela esteja cheia e o envio tenha de esperar
+    if (!link->duplex || link->outstanding == WINDOW_SIZE) acknowledgePending(link, "LLWRITE - RR enviado");
+    if (processAcks(link, WINDOW_SIZE - 1) < 0) return -1;
+
+    // Construção da trama a transmitir diretamente na posição da janela, onde fica até ser confirmada para poder ser retransmitida
+    unsigned char c = N(link->nextSeq) | flags;
+    unsigned char *header = link->windowHeaders[link->nextSeq];
+    header[0] = FLAG;
+    header[1] = A;
+    header[2] = c;
+    header[3] = A ^ c;  // BCC1
+    link->windowBodySizes[link->nextSeq] = encodeInformation(link, buf, bufSize, link->windowBodies[link->nextSeq], link->windowTrailers[link->nextSeq], &link->windowTrailerSizes[link->nextSeq]);
+
+    int size = HEADER_SIZE + link->windowBodySizes[link->nextSeq] + link->windowTrailerSizes[link->nextSeq];
+
+    link->windowTries[link->nextSeq] = link->nRetransmissions;
+    link->windowRetransmitted[link->nextSeq] = FALSE;
+    sendWindowFrame(link, link->nextSeq);
+    link->outstanding++;
+    link->polled = FALSE;
+    link->nextSeq = (link->nextSeq + 1) % SEQ_MODULUS;
+    adaptFec(link);
 
-    free(dataBcc2);
-    free(frame);
     return size;
 }
 
+// Envia os pacotes retidos para agregação numa trama agregada (um só pacote segue numa trama I normal, sem o tamanho)
+// Retorna 1 em caso de sucesso, -1 se foi excedido o número máximo de tentativas de retransmissão
+int flushAggregate(LinkHandle *link) {
+    if (link->aggregateCount == 0) return 1;
+    int count = link->aggregateCount;
+    link->aggregateCount = 0;
+    if (count == 1) return sendInformationFrame(link, link->aggregate + AGGREGATE_PREFIX, link->aggregateSize - AGGREGATE_PREFIX, 0) < 0 ? -1 : 1;
+    link->totalAgregadas++;
+    link->totalPacotesAgregados += count;
+    return sendInformationFrame(link, link->aggregate, link->aggregateSize, C_AGGREGATE) < 0 ? -1 : 1;
+}
+
+// Retorna o tamanho máximo de uma trama agregada: o maior dos últimos AGGREGATE_HISTORY pacotes escritos
+int aggregateLimit(LinkHandle *link) {
+    int limit = 0;
+    for (int i = 0; i < AGGREGATE_HISTORY; i++) {
+        if (link->recentSizes[i] > limit) limit = link->recentSizes[i];
+    }
+    return limit;
+}
+
+// Envia um pacote (ver linkWrite), com o lock da ligação
+int writePacket(LinkHandle *link, const unsigned char *buf, int bufSize) {
+    link->totalWrite++;
+    if (bufSize < 0 || bufSize > link->maxInfoSize) return -1;  // o recetor descartaria a trama
+
+    // Um pacote só é retido se for pequeno e couber com outro na trama agregada (caso contrário, esperaria sem ganho)
+    // Os pacotes retidos seguem antes de um pacote que não pode ir com eles, ou se o primeiro já espera há AGGREGATE_DELAY ms
+    int limit = aggregateLimit(link);
+    link->recentSizes[link->recentHead] = bufSize;
+    link->recentHead = (link->recentHead + 1) % AGGREGATE_HISTORY;
+    int small = link->aggregation && bufSize > 0 && bufSize <= AGGREGATE_MAX_PACKET && 2 * (AGGREGATE_PREFIX + bufSize) <= limit;
+    if (link->aggregateCount > 0 && (!small || link->aggregateSize + AGGREGATE_PREFIX + bufSize > limit || monotonicMillis() >= link->aggregateDeadline)) {
+        if (flushAggregate(link) < 0) return -1;
+    }
+
+    // Com a linha parada (nenhuma trama por confirmar), o pacote segue de imediato; caso contrário fica retido (Nagle)
+    if (small && (link->aggregateCount > 0 || link->outstanding > 0)) {
+        if (link->aggregateCount == 0) {
+            link->aggregateSize = 0;
+            link->aggregateDeadline = monotonicMillis() + AGGREGATE_DELAY;
+        }
+        link->aggregate[link->aggregateSize++] = bufSize / 256;
+        link->aggregate[link->aggregateSize++] = bufSize % 256;
+        memcpy(link->aggregate + link->aggregateSize, buf, bufSize);
+        link->aggregateSize += bufSize;
+        link->aggregateCount++;
+        return bufSize;
+    }
+    return sendInformationFrame(link, buf, bufSize, 0);
+}
+
+int linkWrite(LinkHandle *link, const unsigned char *buf, int bufSize) {
+    pthread_mutex_lock(&link->lock);
+    int result = writePacket(link, buf, bufSize);
+    pthread_mutex_unlock(&link->lock);
+    return result;
+}
+
+int linkFlush(LinkHandle *link) {
+    pthread_mutex_lock(&link->lock);
+    link->totalFlush++;
+    acknowledgePending(link, "LLFLUSH - RR enviado");
+    int result = flushAggregate(link) < 0 || processAcks(link, 0) < 0 ? -1 : 1;
+    pthread_mutex_unlock(&link->lock);
+    return result;
+}
+
+void linkSetAggregation(LinkHandle *link, int enabled) {
+    pthread_mutex_lock(&link->lock);
+    link->aggregation = enabled && link->aggregateAccepted;
+    pthread_mutex_unlock(&link->lock);
+}
+
 ////////////////////////////////////////////////
 // LLREAD
 ////////////////////////////////////////////////
-int llread(unsigned char *packet) {
-    totalRead++;
-    static unsigned char tramaI = 0;
 
-    State state = START_STATE;
-    unsigned char byteRead;
+int linkRead(LinkHandle *link, unsigned char *packet) {
+    return linkReadPlaced(link, packet, 0, NULL, NULL, NULL);
+}
+
+int linkHungUp(LinkHandle *link) {
+    pthread_mutex_lock(&link->lock);
+    int hungUp = link->hungUp;
+    pthread_mutex_unlock(&link->lock);
+    return hungUp;
+}
+
+// Lê da porta série até receber uma trama I, tratando as outras tramas que chegam entretanto (ver linkReadPlaced)
+// Retorna o número de bytes de dados entregues em packet, ou -1 se nenhum pacote foi entregue
+int readInformationFrame(LinkHandle *link, unsigned char *packet, int headerSize, LinkPlacement place, void *context, int *placed) {
+    // A trama anterior terminou num FLAG, que também pode ser o início desta (se o FLAG final da anterior se perdeu)
+    State state = FLAG_RCV_STATE;
     unsigned char aCheck;
     unsigned char cCheck;
-    unsigned char escFound = FALSE;
 
-    int index = 0;
-    int size;
+    while (TRUE) {
+        // Enquanto o estado não for o BCC OK de uma trama, processa os bytes da porta série (um de cada vez)
+        State previous = state;
+        if (processByte(link, A, C_I, C_I ^ C_MASK_I, C_MASK_I, &aCheck, &cCheck, &state, NO_DEADLINE) < 0) return -1;  // espera uma trama I ou outra trama
+        if (headerDamaged(previous, state)) {
+            // Cabeçalho danificado: o resto da trama é descartado de uma vez e a retransmissão é pedida no FLAG que a termina
+            link->totalDanificadas++;
+            link->quickAcks = ACK_QUICK;
+            discardFrame(link);
+            rejectDamaged(link);
+            state = FLAG_RCV_STATE;
+            continue;
+        }
+        if (state != BCC_OK_STATE) continue;
+        if ((cCheck & C_MASK_I) == C_I) return receiveInformation(link, cCheck, packet, headerSize, place, context, placed);
 
-    while (state != BCC_OK_STATE) {
-        // Enquanto o estado não for o BCC OK, processa os bytes da porta série (um de cada vez)
-        processByte(A, N(0), N(1), &aCheck, &cCheck, &state);
+        // Outra trama: em full duplex, as respostas às tramas enviadas pela thread de llwrite são tratadas aqui
+        discardFrame(link);
+        handleResponse(link, cCheck);
+        state = FLAG_RCV_STATE;
     }
+}
 
-    if (cCheck != N(tramaI)) {
-        // Recebeu uma trama de que não estava à espera (duplicada)
-        totalDuplicados++;
-        while (byteRead != FLAG) {
-            // Lê os bytes da porta série (um de cada vez), mas ignora-os - apenas para limpar
-            totalBytes++;
-            read(fd, &byteRead, sizeof(byteRead));
-        }
-        // Responde com a indicação de qual é o índice da trama que está pronto para receber
-        unsigned char n = C_RR(tramaI);
-        unsigned char rr[5] = {FLAG, A, n, A ^ n, FLAG};
-        printLL("LL WRITE - RR enviado", rr, sizeof(rr));  // DEBUG
-        totalTramas++;
-        totalTramasSU++;
-        totalRR++;
-        write(fd, rr, sizeof(rr));
-        return -1;
-    }
+/**
+ * Recebe uma trama I, cujos dados a seguir aos primeiros headerSize bytes vão para o destino escolhido por place
+ * @param packet buffer onde são colocados os dados (ou só os primeiros headerSize bytes, se place escolher um destino)
+ * @param headerSize número de bytes que ficam sempre em packet
+ * @param place escolhe o destino dos restantes, ou NULL para os deixar em packet
+ * @param context argumento de place
+ * @param placed TRUE se os dados foram para o destino escolhido por place (pode ser NULL)
+ * @return número de bytes de dados, ou -1 em caso de erro
+ *
+ * @details
+ * O destino é escolhido antes de verificar o FCS, pelo que pode ficar com os dados de uma trama rejeitada.
+ * Uma trama recebida fora de ordem (ou, em full duplex, durante llwrite) fica no buffer de reordenação e é copiada para o destino
+ * quando é entregue. Os pacotes de uma trama agregada são entregues um por chamada, antes de ser lida a trama seguinte.
+ * O RR das tramas aceites é enviado quando expira o seu prazo (ver fillRxBuffer) ou quando o emissor o pede (C_POLL);
+ * perante um erro, as tramas aceites são confirmadas antes do SREJ.
+ * Em full duplex, se a thread de llwrite estiver a ler da porta série, espera que ela guarde uma trama ou deixe a porta livre
+ */
+int linkReadPlaced(LinkHandle *link, unsigned char *packet, int headerSize, LinkPlacement place, void *context, int *placed) {
+    int cancelState;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelState);  // só pode ser cancelada à espera de bytes (ver waitReadable)
+    pthread_mutex_lock(&link->lock);
+    link->totalRead++;
+    int ignored;
+    if (placed == NULL) placed = &ignored;
+    *placed = FALSE;
 
-    while (state != STOP_STATE) {
-        // Enquanto o estado não for o final, processa os bytes da porta série (um de cada vez)
-        if (state == BCC_OK_STATE && read(fd, &byteRead, sizeof(byteRead)) == sizeof(byteRead)) {
-            totalBytes++;
-            // Destuffing dos dados e do BCC2
-            if (escFound) {
-                if (byteRead == FLAG_ESCAPED) {
-                    totalStuffed++;
-                    totalFlagStuffed++;
-                    packet[index++] = FLAG;
-                } else if (byteRead == ESC_ESCAPED) {
-                    totalStuffed++;
-                    totalEscStuffed++;
-                    packet[index++] = ESC;
-                }
-                escFound = FALSE;
-            } else if (byteRead == ESC) {
-                escFound = TRUE;
-            } else if (byteRead == FLAG) {
-                size = index + 5;  // 5 -> F A C BCC1 F
-                unsigned char bcc2 = packet[index - 1];
-                index--;
-                packet[index] = '\0';                                 // retira o BCC2 do pacote de dados
-                printLL("LLWRITE - pacote recebido", packet, index);  // DEBUG
-                unsigned char bcc2Acc = packet[0];
-                for (int i = 1; i < index; i++) {
-                    // Cálculo do BCC2
-                    bcc2Acc ^= packet[i];
-                }
-                if (bcc2 == bcc2Acc) {
-                    // O valor de BCC2 está correto, pelo que a trama foi recebida com sucesso e o recetor está pronto para a próxima
-                    tramaI = (tramaI + 1) % 2;
-                    unsigned char n = C_RR(tramaI);
-                    unsigned char rr[5] = {FLAG, A, n, A ^ n, FLAG};
-                    printLL("LLWRITE - RR enviado", rr, sizeof(rr));  // DEBUG
-                    totalTramas++;
-                    totalTramasSU++;
-                    totalRR++;
-                    write(fd, rr, sizeof(rr));
-                    state = STOP_STATE;
-                } else {
-                    // O valor de BCC está incorreto, pelo que a trama deve ser retransmitida
-                    totalBCC2++;
-                    unsigned char n = C_REJ(tramaI);
-                    unsigned char rej[5] = {FLAG, A, n, A ^ n, FLAG};
-                    printLL("LLWRITE - REJ enviado", rej, sizeof(rej));  // DEBUG
-                    totalTramas++;
-                    totalTramasSU++;
-                    totalREJ++;
-                    write(fd, rej, sizeof(rej));
-                    state = STOP_STATE;
-                    return -1;
-                }
-            } else {
-                packet[index++] = byteRead;
-            }
+    int size;
+    while (TRUE) {
+        if (link->unpackHead < link->unpackSize) {
+            // Pacotes que faltam entregar da última trama agregada
+            size = deliverUnpacked(link, packet, headerSize, place, context, placed);
+            break;
+        }
+        if (link->reorderReceived[link->expectedSeq]) {
+            // A trama esperada já tinha sido recebida, pelo que é entregue a partir do buffer de reordenação
+            size = link->reorderSizes[link->expectedSeq];
+            unsigned char *buffer = link->reorderBuffer[link->expectedSeq];
+            int aggregated = link->reorderAggregated[link->expectedSeq];
+            link->reorderReceived[link->expectedSeq] = FALSE;
+            acceptExpected(link);
+            if (aggregated)
+                size = storeAggregate(link, buffer, size) < 0 ? -1 : deliverUnpacked(link, packet, headerSize, place, context, placed);
+            else
+                deliverStored(buffer, size, packet, headerSize, place, context, placed);
+            break;
+        }
+        if (!link->reading) {
+            link->reading = TRUE;
+            link->cancelState = cancelState;
+            size = readInformationFrame(link, packet, headerSize, place, context, placed);
+            releaseReading(link);
+            break;
         }
+        waitChanged(link, NO_DEADLINE);
     }
+    pthread_mutex_unlock(&link->lock);
+    pthread_setcancelstate(cancelState, NULL);
     return size;
 }
 
 ////////////////////////////////////////////////
 // LLCLOSE
 ////////////////////////////////////////////////
-int llclose(int showStatistics) {
-    totalClose++;
+// Termina a ligação (DISC/UA) e imprime as estatísticas, se pedido
+// Retorna 1 em caso de sucesso, -1 em caso de erro
+int closeLink(LinkHandle *link, int showStatistics) {
+    link->totalClose++;
     State state = START_STATE;
     unsigned char aCheck;
     unsigned char cCheck;
 
-    int tries = nRetransmissions;
+    int tries = link->nRetransmissions;
+
+    if (link->role == LlTx) {
+        // Antes de terminar a ligação, envia os pacotes retidos e espera que todas as tramas I enviadas sejam confirmadas
+        if (flushAggregate(link) < 0 || processAcks(link, 0) < 0) {
+            printf("LLCLOSE - tramas I por confirmar\n");
+            return -1;
+        }
 
-    if (role == LlTx) {
+        acknowledgePending(link, "LLCLOSE - RR enviado");  // full duplex: as últimas tramas do recetor não esperam por ACK_DELAY
         unsigned char disc[5] = {FLAG, A, C_DISC, A ^ C_DISC, FLAG};
         do {
             printLL("LLCLOSE - enviado DISC", disc, sizeof(disc));  // DEBUG
-            totalTramas++;
-            totalTramasSU++;
-            totalDISC++;
-            write(fd, disc, sizeof(disc));
-            alarm(timeout);
-            alarmEnabled = TRUE;
-            while (alarmEnabled == TRUE && state != STOP_STATE) {
-                // Enquanto o alarme não tiver disparado e estado não for o final, processa os bytes da porta série (um de cada vez)
-                processByte(A_CLOSE, C_DISC, C_DISC, &aCheck, &cCheck, &state);  // espera um DISC
+            link->totalTramas++;
+            link->totalTramasSU++;
+            link->totalDISC++;
+            write(link->fd, disc, sizeof(disc));
+            long long deadline = monotonicMillis() + link->rto;
+            while (state != STOP_STATE) {
+                // Enquanto o prazo não tiver expirado e estado não for o final, processa os bytes da porta série (um de cada vez)
+                if (processByte(link, A_CLOSE, C_DISC, C_DISC, C_MASK_EXACT, &aCheck, &cCheck, &state, deadline) <= 0) break;  // espera um DISC
             }
-            if (state == STOP_STATE) {
-                // O estado final foi alcançado, pelo que o alarme pode ser desativado
-                alarm(0);
-                alarmEnabled = FALSE;
-            } else {
-                // O alarme tocou, pelo que ocorreu timeout e deve haver retransmissão (se ainda não tiver sido excedido o número máximo de tentativas)
+            if (state != STOP_STATE) {
+                // O prazo expirou, pelo que ocorreu timeout e deve haver retransmissão (se ainda não tiver sido excedido o número máximo de tentativas)
+                timerExpired(link);
+                backoffRto(link);
                 tries--;
-                totalRetransmissions++;
+                link->totalRetransmissions++;
             }
-        } while (tries >= 0 && state != STOP_STATE);
+        } while (tries >= 0 && state != STOP_STATE && !link->hungUp);
 
         if (state != STOP_STATE) {
             // Foi excedido o número máximo de tentativas de retransmissão
-            totalRetransmissions--;
+            link->totalRetransmissions--;
             printf("LLCLOSE - DISC não foi recebido\n");
             return -1;
         }
 
         unsigned char ua[5] = {FLAG, A_CLOSE, C_UA, A_CLOSE ^ C_UA, FLAG};
         printLL("LLCLOSE - enviado UA", ua, sizeof(ua));  // DEBUG
-        totalTramas++;
-        totalTramasSU++;
-        totalUA++;
-        write(fd, ua, sizeof(ua));  // quando receber o DISC, rsponde com UA
-    } else if (role == LlRx) {
-        while (state != STOP_STATE) {
-            // Enquanto o estado não for o final, processa os bytes da porta série (um de cada vez)
-            processByte(A, C_DISC, C_DISC, &aCheck, &cCheck, &state);  // espera um DISC
+        link->totalTramas++;
+        link->totalTramasSU++;
+        link->totalUA++;
+        write(link->fd, ua, sizeof(ua));  // quando receber o DISC, rsponde com UA
+    } else if (link->role == LlRx) {
+        // Em full duplex, o recetor também envia os pacotes retidos e espera pela confirmação das suas tramas I;
+        // se não chegar, a ligação termina na mesma, porque o emissor pode já ter enviado o DISC
+        if (link->duplex && (flushAggregate(link) < 0 || processAcks(link, 0) < 0)) printf("LLCLOSE - tramas I por confirmar\n");
+        acknowledgePending(link, "LLCLOSE - RR enviado");  // o emissor espera pela confirmação das últimas tramas antes do DISC
+        while (state != STOP_STATE || cCheck != C_DISC) {
+            // Enquanto não for recebido um DISC, processa os bytes da porta série (um de cada vez)
+            if (state == STOP_STATE) state = START_STATE;  // outra trama não numerada - ignorada
+            if (processByte(link, A, C_I, C_I ^ C_MASK_I, C_MASK_I, &aCheck, &cCheck, &state, NO_DEADLINE) < 0) {  // espera um DISC ou uma trama I
+                printf("LLCLOSE - DISC não foi recebido\n");
+                return -1;
+            }
+            if (state == BCC_OK_STATE && (cCheck & C_MASK_I) == C_I) {
+                // Trama I retransmitida porque a sua confirmação se perdeu - é descartada e confirmada novamente
+                link->totalDuplicados++;
+                discardFrame(link);
+                sendSupervisionFrame(link, "LLCLOSE - RR enviado", C_RR(link->expectedSeq));
+                state = START_STATE;
+            }
         }
         unsigned char disc[5] = {FLAG, A_CLOSE, C_DISC, A_CLOSE ^ C_DISC, FLAG};
-        printLL("LLCLOSE - enviado DISC", disc, sizeof(disc));  // DEBUG
-        totalTramas++;
-        totalTramasSU++;
-        totalDISC++;
-        write(fd, disc, sizeof(disc));  // quando receber o DISC, responde com DISC
+        do {
+            printLL("LLCLOSE - enviado DISC", disc, sizeof(disc));  // DEBUG
+            link->totalTramas++;
+            link->totalTramasSU++;
+            link->totalDISC++;
+            write(link->fd, disc, sizeof(disc));  // quando receber o DISC, responde com DISC
+            // Espera pelo UA final; se o DISC se perder, o emissor repete o seu DISC e a resposta é reenviada
+            // A espera dura o timeout configurado: em full duplex, o RTO do recetor pode ser menor do que o do emissor
+            long long deadline = monotonicMillis() + link->rtoMax;
+            state = START_STATE;
+            while (state != STOP_STATE) {
+                if (processByte(link, A_ANY, C_UA, C_DISC, C_MASK_EXACT, &aCheck, &cCheck, &state, deadline) <= 0) break;  // espera um UA ou um DISC
+                if (state == STOP_STATE && (aCheck != A || cCheck != C_DISC) && (aCheck != A_CLOSE || cCheck != C_UA)) state = START_STATE;
+            }
+        } while (state == STOP_STATE && cCheck == C_DISC);
+        if (state != STOP_STATE) printf("LLCLOSE - UA não foi recebido\n");  // os dados já foram todos entregues
     } else {
         printf("Erro em connectionParameters.role\n");
         return -1;
     }
 
-    close(fd);
-
     if (showStatistics) {
-        clock_t end = clock();
-        float seconds = (float)(end - start) / CLOCKS_PER_SEC;
+        float seconds = (monotonicMillis() - link->start) / 1000.0;
         printf("\n---------- Estatísticas ----------\n");
         printf("\nTempo de Execução: %f segundos\n", seconds);
-        printf("\nInvocações a llopen: %d\n", totalOpen);
-        printf("Invocações a llwrite: %d\n", totalWrite);
-        printf("Invocações a llread: %d\n", totalRead);
-        printf("Invocações a llclose: %d\n", totalClose);
-        printf("\nTramas Enviadas: %d\n", totalTramas);
-        printf("\nTramas de Informação: %d\n", totalTramasI);
-        printf("Tramas de Supervisão/Não Numeradas: %d\n", totalTramasSU);
-        printf("\nTramas SET: %d\n", totalSET);
-        printf("Tramas UA: %d\n", totalUA);
-        printf("Tramas RR: %d\n", totalRR);
-        printf("Tramas REJ: %d\n", totalREJ);
-        printf("Tramas DISC: %d\n", totalDISC);
-        printf("\nBytes Recebidos: %d\n", totalBytes);
-        printf("\nBytes Stuffed/Destuffed: %d\n", totalStuffed);
-        printf("FLAG Stuffed/Destuffed: %d\n", totalFlagStuffed);
-        printf("ESC Stuffed/Destuffed: %d\n", totalEscStuffed);
-        printf("\nAlarmes: %d\n", alarmCount);
-        printf("Retransmissões: %d\n", totalRetransmissions);
-        printf("Erros no BCC1: %d\n", totalBCC1);
-        printf("Erros no BCC2: %d\n", totalBCC2);
-        printf("Tramas Duplicadas: %d\n", totalDuplicados);
+        printf("\nInvocações a llopen: %d\n", link->totalOpen);
+        printf("Invocações a llwrite: %d\n", link->totalWrite);
+        printf("Invocações a llread: %d\n", link->totalRead);
+        printf("Invocações a llclose: %d\n", link->totalClose);
+        printf("Invocações a llflush: %d\n", link->totalFlush);
+        printf("\nTramas Enviadas: %d\n", link->totalTramas);
+        printf("\nTramas de Informação: %d\n", link->totalTramasI);
+        printf("Tramas de Supervisão/Não Numeradas: %d\n", link->totalTramasSU);
+        printf("\nTramas SET: %d\n", link->totalSET);
+        printf("Tramas UA: %d\n", link->totalUA);
+        printf("Tramas RR: %d\n", link->totalRR);
+        printf("Tramas RR (poll): %d\n", link->totalPolls);
+        printf("Confirmações em Tramas I: %d\n", link->totalPiggyback);
+        printf("Tramas REJ: %d\n", link->totalREJ);
+        printf("Tramas SREJ: %d\n", link->totalSREJ);
+        printf("Tramas DISC: %d\n", link->totalDISC);
+        printf("Tramas I Agregadas: %d (%d pacotes)\n", link->totalAgregadas, link->totalPacotesAgregados);
+        printf("\nBytes Recebidos: %d\n", link->totalBytes);
+        printf("\nBytes Stuffed/Destuffed: %d\n", link->totalStuffed);
+        printf("FLAG Stuffed/Destuffed: %d\n", link->totalFlagStuffed);
+        printf("ESC Stuffed/Destuffed: %d\n", link->totalEscStuffed);
+        printf("\nFCS: %s\n", link->fcsMode == FCS_CRC32 ? "CRC-32" : link->fcsMode == FCS_CRC16 ? "CRC-16" : "BCC2");
+        printf("Campo de Informação Máximo: %d bytes\n", link->maxInfoSize);
+        printf("Paridade FEC Máxima: %d bytes por bloco\n", link->fecMax);
+        printf("Agregação: %s\n", link->aggregateAccepted ? "sim" : "não");
+        printf("Full Duplex: %s\n", link->duplex ? "sim" : "não");
+        printf("\nRTT Suavizado: %lld ms\n", link->srtt);
+        printf("RTO: %lld ms\n", link->rto);
+        printf("\nAlarmes: %d\n", link->alarmCount);
+        printf("Retransmissões: %d\n", link->totalRetransmissions);
+        printf("Erros no BCC1: %d\n", link->totalBCC1);
+        printf("Erros no BCC2: %d\n", link->totalBCC2);
+        printf("Tramas Rejeitadas pelo Recetor: %d\n", link->totalRejeitadas);
+        printf("Tramas com o Cabeçalho Danificado: %d\n", link->totalDanificadas);
+        printf("Retransmissões Rápidas: %d\n", link->totalRetransmissoesRapidas);
+        printf("Bytes Corrigidos pelo FEC: %d\n", link->totalFecBytes);
+        printf("Tramas Corrigidas pelo FEC: %d\n", link->totalFecTramas);
+        printf("Tramas Duplicadas: %d\n", link->totalDuplicados);
+        printf("Tramas Fora de Ordem: %d\n", link->totalForaDeOrdem);
     }
 
     return 1;
 }
+
+void linkAbort(LinkHandle *link) {
+    close(link->fd);
+    pthread_mutex_destroy(&link->lock);
+    pthread_cond_destroy(&link->changed);
+    free(link);
+}
+
+int linkClose(LinkHandle *link, int showStatistics) {
+    pthread_mutex_lock(&link->lock);
+    int result = closeLink(link, showStatistics);
+    pthread_mutex_unlock(&link->lock);
+    linkAbort(link);
+    return result;
+}
+
+////////////////////////////////////////////////
+// LLSTATISTICS
+////////////////////////////////////////////////
+
+void linkStatistics(LinkHandle *link, LinkStatistics *stats) {
+    pthread_mutex_lock(&link->lock);
+    stats->maxPayloadSize = link->maxInfoSize;
+    stats->framesSent = link->totalTramasI;
+    stats->retransmissions = link->totalRetransmissions;
+    stats->timeouts = link->alarmCount;
+    stats->rejectsReceived = link->totalRejeitadas;
+    stats->fcsErrors = link->totalBCC2;
+    pthread_mutex_unlock(&link->lock);
+}
+
+////////////////////////////////////////////////
+// LLOPEN, LLWRITE, LLREAD, LLCLOSE (UMA SÓ LIGAÇÃO)
+////////////////////////////////////////////////
+
+// Ligação usada pelas funções de link_layer.h, link_control.h e link_stats.h, que não recebem a ligação
+LinkHandle *defaultLink = NULL;
+
+int llopen(LinkLayer connectionParameters) {
+    defaultLink = linkOpen(connectionParameters);
+    return defaultLink == NULL ? -1 : 1;
+}
+
+int llwrite(const unsigned char *buf, int bufSize) {
+    return linkWrite(defaultLink, buf, bufSize);
+}
+
+int llflush() {
+    return linkFlush(defaultLink);
+}
+
+int llread(unsigned char *packet) {
+    return linkRead(defaultLink, packet);
+}
+
+int llclose(int showStatistics) {
+    int result = linkClose(defaultLink, showStatistics);
+    defaultLink = NULL;
+    return result;
+}
+
+void llstatistics(LinkStatistics *stats) {
+    if (defaultLink == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    linkStatistics(defaultLink, stats);
+}
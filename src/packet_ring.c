@@ -0,0 +1,62 @@
+// Packet ring implementation
+
+#include "packet_ring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+// Cada índice só é escrito por uma das threads; os semáforos contam as posições vazias e cheias e garantem que
+// o conteúdo de uma posição é visível à outra thread. Enquanto houver posições disponíveis, sem_wait/sem_post
+// são apenas operações atómicas, pelo que as threads só bloqueiam (sem ocupar o processador) com o anel cheio ou vazio
+
+// Espera por uma unidade do semáforo, repetindo se a espera for interrompida por um sinal
+void ringWait(sem_t *semaphore) {
+    while (sem_wait(semaphore) == -1 && errno == EINTR) {
+    }
+}
+
+int ringInit(PacketRing *ring, int slots, int slotSize) {
+    ring->buffers = (unsigned char *)malloc(slots * slotSize);
+    ring->sizes = (int *)malloc(slots * sizeof(int));
+    if (ring->buffers == NULL || ring->sizes == NULL) {
+        free(ring->buffers);
+        free(ring->sizes);
+        return -1;
+    }
+    ring->slots = slots;
+    ring->slotSize = slotSize;
+    ring->head = 0;
+    ring->tail = 0;
+    sem_init(&ring->emptySlots, 0, slots);
+    sem_init(&ring->fullSlots, 0, 0);
+    return 1;
+}
+
+unsigned char *ringAcquire(PacketRing *ring) {
+    ringWait(&ring->emptySlots);
+    return ring->buffers + ring->head * ring->slotSize;
+}
+
+void ringPublish(PacketRing *ring, int size) {
+    ring->sizes[ring->head] = size;
+    ring->head = (ring->head + 1) % ring->slots;
+    sem_post(&ring->fullSlots);
+}
+
+unsigned char *ringPeek(PacketRing *ring, int *size) {
+    ringWait(&ring->fullSlots);
+    *size = ring->sizes[ring->tail];
+    return ring->buffers + ring->tail * ring->slotSize;
+}
+
+void ringRelease(PacketRing *ring) {
+    ring->tail = (ring->tail + 1) % ring->slots;
+    sem_post(&ring->emptySlots);
+}
+
+void ringDestroy(PacketRing *ring) {
+    sem_destroy(&ring->emptySlots);
+    sem_destroy(&ring->fullSlots);
+    free(ring->buffers);
+    free(ring->sizes);
+}
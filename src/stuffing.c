@@ -0,0 +1,91 @@
+// Byte stuffing implementation
+
+#include "stuffing.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STUFFING_SIMD 1
+#endif
+
+#define FLAG 0x7E
+#define ESC 0x7D
+#define ESCAPE_XOR 0x20  // FLAG -> 0x5E e ESC -> 0x5D
+
+#ifdef STUFFING_SIMD
+int avx2Available = 0;
+#endif
+
+void stuffingInit() {
+#ifdef STUFFING_SIMD
+    __builtin_cpu_init();
+    avx2Available = __builtin_cpu_supports("avx2");
+#endif
+}
+
+// Versão escalar: compara um byte de cada vez
+int findSpecialScalar(const unsigned char *data, int size) {
+    int i = 0;
+    while (i < size && data[i] != FLAG && data[i] != ESC) i++;
+    return i;
+}
+
+#ifdef STUFFING_SIMD
+// Compara 16 bytes de cada vez com FLAG e ESC; o resto é comparado byte a byte
+__attribute__((target("sse2"))) int findSpecialSse2(const unsigned char *data, int size) {
+    const __m128i flag = _mm_set1_epi8(FLAG);
+    const __m128i esc = _mm_set1_epi8(ESC);
+    int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, flag), _mm_cmpeq_epi8(block, esc)));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + findSpecialScalar(data + i, size - i);
+}
+
+// Compara 32 bytes de cada vez com FLAG e ESC; o resto é comparado com SSE2
+__attribute__((target("avx2"))) int findSpecialAvx2(const unsigned char *data, int size) {
+    const __m256i flag = _mm256_set1_epi8(FLAG);
+    const __m256i esc = _mm256_set1_epi8(ESC);
+    int i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, flag), _mm256_cmpeq_epi8(block, esc)));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + findSpecialSse2(data + i, size - i);
+}
+#endif
+
+int findSpecial(const unsigned char *data, int size) {
+#ifdef STUFFING_SIMD
+    if (avx2Available) return findSpecialAvx2(data, size);
+    return findSpecialSse2(data, size);
+#else
+    return findSpecialScalar(data, size);
+#endif
+}
+
+int stuffBytes(const unsigned char *src, int size, unsigned char *dest, int *flagsStuffed, int *escsStuffed) {
+    int index = 0;
+    while (size > 0) {
+        // Copia de uma vez os bytes até ao próximo FLAG ou ESC
+        int run = findSpecial(src, size);
+        memcpy(dest + index, src, run);
+        index += run;
+        src += run;
+        size -= run;
+        if (size == 0) break;
+
+        // Stuffing do FLAG ou ESC encontrado
+        *flagsStuffed += (*src == FLAG);
+        *escsStuffed += (*src == ESC);
+        dest[index++] = ESC;
+        dest[index++] = *src ^ ESCAPE_XOR;
+        src++;
+        size--;
+    }
+    return index;
+}